@@ -25,11 +25,31 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdarg.h>
 #include <string.h>
+#include <math.h>
 #include <setjmp.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifndef __MINGW32__
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
 
+#include <zlib.h>
 #include "hpdf.h"
 #include "gpdf.h"
 
@@ -42,47 +62,34 @@ static const int pagesizes[5][2] =
 
 static const double multiplier = 72.0 / 25.4;
 
-indi inds[SIZE_INDS] = {};
-faml fams[SIZE_FAMS] = {};
-
-int genc[SIZE_GENS] = {};
-
-indi *indp;
-faml *famp;
-
-int state = STATE_NONE;
-int date = DATE_NONE;
-int plac = PLAC_NONE;
-
-int fmss = 0;
-int chln = 0;
-int gens = 0;
-
-// Start individuals and families at index 1, then 0 is an unused slot
-
-int indindex = 1;
-int famindex = 1;
-
-int slotmax = 0;
-
 bool writetext = false;
 bool readtext = false;
 bool boldnames = false;
+bool showstats = false;
+bool autolayout = false;
+bool writeposn = false;
+bool snapshot = false;
+bool streaming = false;
+
+// libHaru's allocator gets no user data, so the heap for the document
+// is kept per thread, one document at a time on each
+
+__thread heap docheap;
 
-char file[SIZE_NAME];
 char text[SIZE_NAME];
 
 char *progname;
 
 float fontsize = SIZE_FONT;
 int   pagesize = SIZE_PAGE;
-
-// jmp_buf for arcane HPDF error handler
-
-jmp_buf env;
+int   threads  = 1;
+int   tilecols = 1;
+int   tilerows = 1;
+int   compression = HPDF_COMP_NONE;
 
 int main(int argc, char *argv[])
 {
+    gpdf_context context;
     int c;
 
     // Store program name for error messages
@@ -93,18 +100,38 @@ int main(int argc, char *argv[])
 
     opterr = 0;
 
-    while ((c = getopt(argc, argv, "bwr:f:p:")) != -1)
+    while ((c = getopt(argc, argv, "abcmswxr:f:j:p:t:z:")) != -1)
     {
 	switch (c)
 	{
+	case 'a':
+	    autolayout = true;
+	    break;
+
 	case 'b':
 	    boldnames = true;
 	    break;
 
+	case 'c':
+	    snapshot = true;
+	    break;
+
+	case 'm':
+	    streaming = true;
+	    break;
+
+	case 's':
+	    showstats = true;
+	    break;
+
 	case 'w':
 	    writetext = true;
 	    break;
 
+	case 'x':
+	    writeposn = true;
+	    break;
+
 	case 'r':
 	    readtext = true;
 	    strncpy(text, optarg, sizeof(text) - 1);
@@ -114,6 +141,46 @@ int main(int argc, char *argv[])
 	    fontsize = atof(optarg);
 	    break;
 
+	case 'j':
+	    threads = atoi(optarg);
+
+	    if ((threads < 1) || (threads > SIZE_THREADS))
+	    {
+		fprintf (stderr, "%s: '%s' is not a valid number of threads\n",
+			 progname, optarg);
+		return GPDF_ERROR;
+	    }
+	    break;
+
+	case 't':
+	    if ((sscanf(optarg, "%dx%d", &tilecols, &tilerows) != 2) ||
+		(tilecols < 1) || (tilerows < 1) ||
+		(tilecols * tilerows > SIZE_TILES))
+	    {
+		fprintf (stderr, "%s: '%s' is not a valid number of pages\n",
+			 progname, optarg);
+		return GPDF_ERROR;
+	    }
+	    break;
+
+	case 'z':
+	    if (strcmp(optarg, "none") == 0)
+		compression = HPDF_COMP_NONE;
+
+	    else if (strcmp(optarg, "text") == 0)
+		compression = HPDF_COMP_TEXT;
+
+	    else if (strcmp(optarg, "all") == 0)
+		compression = HPDF_COMP_ALL;
+
+	    else
+	    {
+		fprintf (stderr, "%s: '%s' is not a valid compression\n",
+			 progname, optarg);
+		return GPDF_ERROR;
+	    }
+	    break;
+
 	case 'p':
 	    if ((tolower(optarg[0]) == 'a') &&
 		(atoi(&optarg[1]) >= 0) && (atoi(&optarg[1]) <= 4))
@@ -128,7 +195,8 @@ int main(int argc, char *argv[])
 	    break;
 
 	case '?':
-	    if (optopt == 'f')
+	    if ((optopt == 'f') || (optopt == 'j') || (optopt == 'p') ||
+		(optopt == 'r') || (optopt == 't') || (optopt == 'z'))
 		fprintf (stderr, "%s: Option -%c requires an argument\n",
 			 progname, optopt);
 
@@ -150,1110 +218,5137 @@ int main(int argc, char *argv[])
     if (argv[optind] == NULL)
     {
 	fprintf(stderr,
-		"Usage: %s [-w] [-r <textfile>] [-p pagesize] "
-		"[-f fontsize] <infile>\n\n",
+		"Usage: %s [-a] [-c] [-m] [-s] [-w] [-x] [-r <textfile>] "
+		"[-j threads] [-p pagesize] [-t columnsxrows] [-f fontsize] "
+		"[-z none|text|all] <infile>\n\n",
 		progname);
+	fprintf(stderr, "  -a - lay out the individuals automatically\n");
+	fprintf(stderr, "  -c - keep a snapshot of the parsed input\n");
+	fprintf(stderr, "  -m - write pages to the file as they are drawn\n");
+	fprintf(stderr, "  -s - show parse statistics\n");
 	fprintf(stderr, "  -w - write text file and layout page\n");
-	fprintf(stderr, "  -r - read text file before write\n");
+	fprintf(stderr, "  -x - write positions to a binary file\n");
+	fprintf(stderr, "  -r - read text file before write, with -a lay out\n"
+		"       only the individuals changed since\n");
 	// fprintf(stderr, "  -b - surnames in bold text\n");
+	fprintf(stderr, "  -j - parse, lay out and draw with this many threads\n");
 	fprintf(stderr, "  -p - set page size A0 -- A4\n");
+	fprintf(stderr, "  -t - spread the chart over pages, like 3x2\n");
 	fprintf(stderr, "  -f - set font size in points (1/72 inch)\n");
+	fprintf(stderr, "  -z - compress the page content, default none\n");
 
 	return GPDF_ERROR;
     }
 
     int result;
+    struct timeval start, end;
 
-    // Parse the input file
+    // Load the snapshot of the parsed input, or parse the input file
 
-    result = parse_gedcom_file(argv[optind]);
+    init_context(&context);
 
-    if (result != GPDF_SUCCESS)
+    gettimeofday(&start, NULL);
+
+    if (snapshot && (load_snapshot(&context, argv[optind]) == GPDF_SUCCESS))
     {
-	fprintf(stderr, "%s: Couldn't parse %s\n", progname, argv[optind]);
-	return GPDF_ERROR;
+	gettimeofday(&end, NULL);
+
+	if (showstats)
+	    printf("Snapshot %d individuals, %d families in %1.3f sec, "
+		   "%zu bytes\n", context.indindex - 1, context.famindex - 1,
+		   elapsed(&start, &end), context.snapsize);
+    }
+
+    else
+    {
+	result = parse_gedcom_file(&context, argv[optind]);
+	gettimeofday(&end, NULL);
+
+	if (result != GPDF_SUCCESS)
+	{
+	    fprintf(stderr, "%s: Couldn't parse %s\n", progname,
+		    argv[optind]);
+	    return GPDF_ERROR;
+	}
+
+	if (showstats)
+	{
+	    float secs = elapsed(&start, &end);
+
+	    printf("Parse %d individuals, %d families in %1.3f sec, "
+		   "%1.1f MB/sec\n", context.indindex - 1,
+		   context.famindex - 1, secs,
+		   (secs > 0)? context.bytes / secs / 1e6: 0);
+	    printf("Index %d lookups, %d probes, %1.2f probes/lookup\n",
+		   context.lookups, context.probes, context.lookups?
+		   (float)context.probes / context.lookups: 0);
+
+	    if (context.merges > 0)
+		printf("Merge %d lookups, %d probes, %1.2f probes/lookup\n",
+		       context.merges, context.mergeprobes,
+		       (float)context.mergeprobes / context.merges);
+
+	    printf("Strings %d, %d shared, %1.1f%% hits, "
+		   "%zu bytes saved\n", context.interns, context.shared,
+		   context.interns? 100.0 * context.shared / context.interns:
+		   0, context.saved);
+	}
+
+	// Save a snapshot for next time
+
+	if (snapshot)
+	    save_snapshot(&context, argv[optind]);
     }
 
     // Find generations in data
 
-    find_generations();
+    gettimeofday(&start, NULL);
+    find_generations(&context);
+    gettimeofday(&end, NULL);
+
+    if (showstats)
+    {
+	printf("Generations %d in %1.3f sec\n", context.gens,
+	       elapsed(&start, &end));
+	printf("Records %d + %d bytes, text %d + %d bytes, "
+	       "%zu bytes of strings\n", (int)sizeof(indi), (int)sizeof(faml),
+	       (int)sizeof(itext), (int)sizeof(ftext), context.strings.used);
+    }
 
     // If reading text file
 
+    bool previous = false;
+
     if (readtext)
-	read_textfile();
+    {
+	gettimeofday(&start, NULL);
+	previous = (read_textfile(&context) == GPDF_SUCCESS);
+	gettimeofday(&end, NULL);
+
+	// Without -a there's nothing to draw from, and reading it again
+	// would only fail again
+
+	if (!previous && !autolayout)
+	    return GPDF_ERROR;
+
+	if (showstats && previous)
+	    printf("Positions %d read, %d not found in %1.3f sec\n",
+		   context.kept + context.moved, context.removed,
+		   elapsed(&start, &end));
+    }
+
+    // Lay out the individuals, or just those changed since the text
+    // file read
+
+    if (autolayout)
+    {
+	gettimeofday(&start, NULL);
+	result = previous? relayout_individuals(&context):
+	    layout_individuals(&context);
+	gettimeofday(&end, NULL);
+
+	if (result != GPDF_SUCCESS)
+	{
+	    fprintf(stderr, "%s: Couldn't lay out %s\n", progname,
+		    argv[optind]);
+	    return GPDF_ERROR;
+	}
+
+	if (showstats && previous)
+	    printf("Relayout %d kept, %d new, %d moved, %d removed, "
+		   "%d placed in %1.3f sec\n", context.kept, context.added,
+		   context.moved, context.removed, context.placed,
+		   elapsed(&start, &end));
+
+	else if (showstats)
+	    printf("Layout %d slots, %lld crossings from %lld in %1.3f sec\n",
+		   context.slotmax, context.crossings[1], context.crossings[0],
+		   elapsed(&start, &end));
+    }
 
     // If writing text file
 
     if (writetext)
-	write_textfile();
+	write_textfile(&context);
+
+    // If writing binary positions
+
+    if (writeposn)
+	write_posnfile(&context);
 
     // Draw the tree
 
-    draw_pdf();
+    draw_pdf(&context);
+
+    // Release the records
+
+    free_context(&context);
 
     return GPDF_SUCCESS;
 }
 
-// Resolve GEDCOM xrefs
+// Seconds between two times
 
-int find_individual(char *xref)
+float elapsed(struct timeval *start, struct timeval *end)
 {
-    // Overflow check
-
-    if (indindex >= SIZE_INDS)
-	return 0;
-
-    for (int i = 1; i < indindex; i++)
-    {
-	// If found return id
+    return (end->tv_sec - start->tv_sec) +
+	(end->tv_usec - start->tv_usec) / 1e6;
+}
 
-	if ((inds[i].id > 0) && (strcmp(inds[i].xref, xref) == 0))
-	{
-	    return inds[i].id;
-	}
-    }
+// Find a record in an arena, chunk n holds base << n records, so
+// existing records never move when the arena grows
 
-    // Use next slot, save xref and return id
+void *arena_record(arena *arena, int id)
+{
+    int chunk = 31 - __builtin_clz(id / arena->base + 1);
+    int offset = id - (arena->base * ((1 << chunk) - 1));
 
-    inds[indindex].id = indindex;
-    strncpy(inds[indindex].xref, xref, SIZE_XREF - 1);
-    return inds[indindex++].id;
+    return arena->chunks[chunk] + ((size_t)offset * arena->size);
 }
 
-int find_family(char *xref)
+// Get a new record, allocating its chunk on first use
+
+void *arena_alloc(arena *arena, int id)
 {
-    // Overflow check
+    int chunk = 31 - __builtin_clz(id / arena->base + 1);
 
-    if (famindex >= SIZE_FAMS)
-	return 0;
+    if (chunk >= SIZE_CHUNKS)
+	return NULL;
 
-    for (int i = 1; i < famindex; i++)
+    if (arena->chunks[chunk] == NULL)
     {
-	// If found return id
+	arena->chunks[chunk] = calloc((size_t)arena->base << chunk,
+				      arena->size);
 
-	if ((fams[i].id > 0) && (strcmp(fams[i].xref, xref) == 0))
-	{
-	    return fams[i].id;
-	}
+	if (arena->chunks[chunk] == NULL)
+	    return NULL;
     }
 
-    // Use next slot, save xref and return id
-
-    fams[famindex].id = famindex;
-    strncpy(fams[famindex].xref, xref, SIZE_XREF - 1);
-    return fams[famindex++].id;
+    return arena_record(arena, id);
 }
 
-int parse_gedcom_file(char *filename)
+void free_arena(arena *arena)
 {
-    FILE *infile = NULL;;
-    char line[SIZE_LINE];
-    char *linep = line;
-    size_t size = sizeof(line);
-    int status;
-
-    // Open the file
+    for (int i = 0; i < SIZE_CHUNKS; i++)
+    {
+	free(arena->chunks[i]);
+	arena->chunks[i] = NULL;
+    }
+}
 
-    infile = fopen(filename, "r");
+indi *individual(gpdf_context *ctx, int id)
+{
+    return arena_record(&ctx->inds, id);
+}
 
-    if (infile == NULL)
-	return GPDF_ERROR;
+faml *family(gpdf_context *ctx, int id)
+{
+    return arena_record(&ctx->fams, id);
+}
 
-    // Get lines
+itext *individual_text(gpdf_context *ctx, int id)
+{
+    return arena_record(&ctx->indtext, id);
+}
 
-    while (getline(&linep, &size, infile) != -1)
-    {
-	int type = 0;
-	char first[SIZE_NAME] = {0};
-	char second[SIZE_NAME] = {0};
+ftext *family_text(gpdf_context *ctx, int id)
+{
+    return arena_record(&ctx->famtext, id);
+}
 
-	// parse fields
+// Get a string from the pool, offset 0 is always empty
 
-	sscanf(line, "%d %63s %63[0-9a-zA-Z /@-]", &type, first, second);
+char *string(gpdf_context *ctx, int offset)
+{
+    return ctx->strings.data + offset;
+}
 
-	// Check record type
+// Make room for more strings, doubling the pool as it fills
 
-	switch (type)
-	{
-	case TYPE_OBJECT:
-	    status = object(first, second);
-	    break;
+int grow_pool(pool *pool, size_t count)
+{
+    if (pool->used + count > pool->size)
+    {
+	size_t size = (pool->size == 0)? SIZE_POOL: pool->size;
+	char *data;
 
-	case TYPE_PROP:
-	    status = property(first, second);
-	    break;
+	while (pool->used + count > size)
+	    size *= 2;
 
-	case TYPE_ATTR:
-	    status = attrib(first, second);
-	    break;
-	}
+	data = realloc(pool->data, size);
 
-	if (status != GPDF_SUCCESS)
-	{
-	    fclose(infile);
+	if (data == NULL)
 	    return GPDF_ERROR;
-	}
-    }
 
-    fclose(infile);
+	pool->data = data;
+	pool->size = size;
+    }
 
     return GPDF_SUCCESS;
 }
 
-int object(char *first, char *second)
+// Add a token to the pool and put its offset in a record field
+
+int copy_string(gpdf_context *ctx, int *field, view token)
 {
-    // Head
+    if (grow_pool(&ctx->strings, token.n + 1) != GPDF_SUCCESS)
+	return GPDF_ERROR;
 
-    if (strcmp(first, "HEAD") == 0)
-    {
-	state = STATE_HEAD;
-    }
+    memcpy(ctx->strings.data + ctx->strings.used, token.p, token.n);
+    ctx->strings.data[ctx->strings.used + token.n] = '\0';
+
+    *field = ctx->strings.used;
+    ctx->strings.used += token.n + 1;
+
+    return GPDF_SUCCESS;
+}
 
-    // Individual
+// Make room for more links, doubling the list as it fills
 
-    else if (strcmp(second, "INDI") == 0)
+int grow_edges(gpdf_context *ctx, int count)
+{
+    if (ctx->nedges + count > ctx->maxedges)
     {
-	int id = 0;
-	char xref[SIZE_XREF];
+	int size = (ctx->maxedges == 0)? SIZE_EDGES: ctx->maxedges;
+	edge *edges;
 
-	sscanf(first, "@%31[0-9A-Za-z_]@", xref);
+	while (ctx->nedges + count > size)
+	    size *= 2;
 
-	id = find_individual(xref);
+	edges = realloc(ctx->edges, size * sizeof(edge));
 
-	if (id == 0)
-	{
-	    fprintf(stderr, "%s: Can't find slot for '%s'\n", progname, first);
+	if (edges == NULL)
 	    return GPDF_ERROR;
-	}
 
-	indp = &inds[id];
-	indp->id = id;
-	state = STATE_INDI;
-	fmss = 0;
+	ctx->edges = edges;
+	ctx->maxedges = size;
     }
 
-    // Family
-
-    else if (strcmp(second, "FAM") == 0)
-    {
-	int id = 0;
-	char xref[SIZE_XREF];
+    return GPDF_SUCCESS;
+}
 
-	sscanf(first, "@%31[0-9A-Za-z_]@", xref);
+int add_edge(gpdf_context *ctx, int type, int from, int to)
+{
+    if (grow_edges(ctx, 1) != GPDF_SUCCESS)
+	return GPDF_ERROR;
 
-	id = find_family(xref);
+    ctx->edges[ctx->nedges].type = type;
+    ctx->edges[ctx->nedges].from = from;
+    ctx->edges[ctx->nedges].to = to;
+    ctx->nedges++;
 
-	if (id == 0)
-	{
-	    fprintf(stderr, "%s: Can't find slot for '%s'\n", progname, first);
-	    return GPDF_ERROR;
-	}
+    return GPDF_SUCCESS;
+}
 
-	famp = &fams[id];
-	famp->id = id;
-	state = STATE_FAML;
-	chln = 0;
-    }
+// Compressed rows are built by counting each row in index[i + 1],
+// adding up the counts, filling in the list using index[i] to keep
+// track, then moving the index back
 
-    else
-	state = STATE_NONE;
+int start_csr(csr *csr, int n)
+{
+    csr->index = calloc(n + 1, sizeof(int));
 
-    return GPDF_SUCCESS;
+    return (csr->index == NULL)? GPDF_ERROR: GPDF_SUCCESS;
 }
 
-int property(char *first, char *second)
+int fill_csr(csr *csr, int n)
 {
-    switch (state)
-    {
-	// Head
+    for (int i = 0; i < n; i++)
+	csr->index[i + 1] += csr->index[i];
 
-    case STATE_HEAD:
-	if (strcmp(first, "FILE") == 0)
-	{
-	    strncpy(file, second, sizeof(file) - 1);
-	}
-	break;
+    csr->list = malloc((csr->index[n] + 1) * sizeof(int));
 
-	// Individual
+    return (csr->list == NULL)? GPDF_ERROR: GPDF_SUCCESS;
+}
 
-    case STATE_INDI:
-	if (strcmp(first, "NAME") == 0)
-	{
-	    strncpy(indp->name, second, SIZE_NAME - 1);
-	}
+void end_csr(csr *csr, int n)
+{
+    for (int i = n; i > 0; i--)
+	csr->index[i] = csr->index[i - 1];
 
-	else if (strcmp(first, "SEX") == 0)
-	{
-	    strncpy(indp->sex, second, SIZE_SEX - 1);
-	}
+    csr->index[0] = 0;
+}
 
-	else if (strcmp(first, "BIRT") == 0)
-	{
-	    date = DATE_BIRT;
-	    plac = PLAC_BIRT;
-	}
+void free_csr(csr *csr)
+{
+    free(csr->index);
+    free(csr->list);
 
-	else if (strcmp(first, "DEAT") == 0)
-	{
-	    indp->deat.yes = true;
-	    date = DATE_DEAT;
-	    plac = PLAC_DEAT;
-	}
+    csr->index = NULL;
+    csr->list = NULL;
+}
 
-	else if (strcmp(first, "FAMC") == 0)
-	{
-	    int id = 0;
-	    char xref[SIZE_XREF];
+// Start individuals and families at index 1, then 0 is an unused slot
 
-	    sscanf(second, "@%31[0-9A-Za-z_]@", xref);
+void init_context(gpdf_context *ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
 
-	    id = find_family(xref);
+    ctx->inds.size = sizeof(indi);
+    ctx->inds.base = SIZE_INDS;
+    ctx->fams.size = sizeof(faml);
+    ctx->fams.base = SIZE_FAMS;
+    ctx->indtext.size = sizeof(itext);
+    ctx->indtext.base = SIZE_INDS;
+    ctx->famtext.size = sizeof(ftext);
+    ctx->famtext.base = SIZE_FAMS;
 
-	    if (id == 0)
-	    {
-		fprintf(stderr, "%s: Can't find slot for '%s'\n",
-			progname, second);
-		return GPDF_ERROR;
-	    }
+    ctx->indindex = 1;
+    ctx->famindex = 1;
 
-	    indp->famc = &fams[id];
-	}
+    // Start the pool with the empty string
 
-	else if (strcmp(first, "FAMS") == 0)
-	{
-	    int id = 0;
-	    char xref[SIZE_XREF];
+    ctx->strings.data = calloc(SIZE_POOL, 1);
+    ctx->strings.size = (ctx->strings.data == NULL)? 0: SIZE_POOL;
+    ctx->strings.used = 1;
 
-	    sscanf(second, "@%31[0-9A-Za-z_]@", xref);
+    ctx->state = STATE_NONE;
+    ctx->date = DATE_NONE;
+    ctx->plac = PLAC_NONE;
+}
 
-	    id = find_family(xref);
+// Release all the records and indexes in one go
 
-	    if (id == 0)
-	    {
-		fprintf(stderr, "%s: Can't find slot for '%s'\n",
-			progname, second);
-		return GPDF_ERROR;
-	    }
+void free_context(gpdf_context *ctx)
+{
+    if (ctx->snapshot != NULL)
+	unload_snapshot(ctx);
+
+    free_arena(&ctx->inds);
+    free_arena(&ctx->fams);
+    free_arena(&ctx->indtext);
+    free_arena(&ctx->famtext);
+    free(ctx->strings.data);
+
+    free(ctx->strhash.slots);
+    free(ctx->indhash.slots);
+    free(ctx->famhash.slots);
+
+    free(ctx->edges);
+    free_csr(&ctx->parents);
+    free_csr(&ctx->spouses);
+    free_csr(&ctx->families);
+    free_csr(&ctx->children);
+
+    free(ctx->runs);
+    free(ctx->runindex);
+    free(ctx->scratch.data);
+
+    free(ctx->widthhash.slots);
+    free(ctx->measures);
+    free(ctx->widths);
+    free(ctx->segments);
+}
 
-	    indp->fams[fmss++] = &fams[id];
-	}
+// Compare a token with a tag
 
-	else if (strcmp(first, "NCHI") == 0)
-	{
-	    indp->nchi = atoi(second);
-	}
+bool is_tag(view token, char *tag)
+{
+    return (strlen(tag) == (size_t)token.n) &&
+	(memcmp(token.p, tag, token.n) == 0);
+}
 
-	else if (strcmp(first, "OCCU") == 0)
-	{
-	    strncpy(indp->occu, second, SIZE_OCCU - 1);
-	}
+// Copy a token into a record field, truncating to fit
 
-	else
-	{
-	    date = DATE_NONE;
-	    plac = PLAC_NONE;
-	}
-	break;
+void copy_token(char *field, view token, int size)
+{
+    int n = (token.n < size)? token.n: size - 1;
 
-	// Family
+    memcpy(field, token.p, n);
+    field[n] = '\0';
+}
 
-    case STATE_FAML:
-	if (strcmp(first, "HUSB") == 0)
-	{
-	    int id = 0;
-	    char xref[SIZE_XREF];
+// Get the xref from inside an @xref@ token
 
-	    sscanf(second, "@%31[0-9A-Za-z_]@", xref);
+view get_xref(view token)
+{
+    view xref = {token.p, 0};
 
-	    id = find_individual(xref);
+    if ((token.n > 0) && (token.p[0] == '@'))
+    {
+	xref.p++;
+	while ((xref.n < token.n - 1) && (xref.n < SIZE_XREF - 1) &&
+	       (isalnum((unsigned char)xref.p[xref.n]) ||
+		(xref.p[xref.n] == '_')))
+	    xref.n++;
+    }
 
-	    if (id == 0)
-	    {
-		fprintf(stderr, "%s: Can't find slot for '%s'\n",
-			progname, second);
-		return GPDF_ERROR;
-	    }
+    return xref;
+}
 
-	    famp->husb = &inds[id];
-	}
+// Pack up to four tag characters into an int for a switch
 
-	else if (strcmp(first, "WIFE") == 0)
-	{
-	    int id = 0;
-	    char xref[SIZE_XREF];
+#define PACK(a, b, c, d) ((a) | ((b) << 8) | ((c) << 16) | ((d) << 24))
 
-	    sscanf(second, "@%31[0-9A-Za-z_]@", xref);
+// Identify a tag in one switch rather than a chain of compares
 
-	    id = find_individual(xref);
+int find_tag(view token)
+{
+    unsigned int packed = 0;
 
-	    if (id == 0)
-	    {
-		fprintf(stderr, "%s: Can't find slot for '%s'\n",
-			progname, second);
-		return GPDF_ERROR;
-	    }
+    // Only _MARNM is longer than four characters
 
-	    famp->wife = &inds[id];
-	}
+    if (token.n > 4)
+	return is_tag(token, "_MARNM")? TAG_MARNM: TAG_NONE;
 
-	else if (strcmp(first, "CHIL") == 0)
-	{
-	    int id = 0;
-	    char xref[SIZE_XREF];
+    for (int i = 0; i < token.n; i++)
+	packed |= (unsigned int)(unsigned char)token.p[i] << (i * 8);
 
-	    sscanf(second, "@%31[0-9A-Za-z_]@", xref);
+    switch (packed)
+    {
+    case PACK('H', 'E', 'A', 'D'):
+	return TAG_HEAD;
+
+    case PACK('F', 'I', 'L', 'E'):
+	return TAG_FILE;
+
+    case PACK('I', 'N', 'D', 'I'):
+	return TAG_INDI;
+
+    case PACK('F', 'A', 'M', 0):
+	return TAG_FAM;
+
+    case PACK('N', 'A', 'M', 'E'):
+	return TAG_NAME;
+
+    case PACK('S', 'E', 'X', 0):
+	return TAG_SEX;
+
+    case PACK('B', 'I', 'R', 'T'):
+	return TAG_BIRT;
+
+    case PACK('D', 'E', 'A', 'T'):
+	return TAG_DEAT;
+
+    case PACK('F', 'A', 'M', 'C'):
+	return TAG_FAMC;
+
+    case PACK('F', 'A', 'M', 'S'):
+	return TAG_FAMS;
+
+    case PACK('N', 'C', 'H', 'I'):
+	return TAG_NCHI;
+
+    case PACK('O', 'C', 'C', 'U'):
+	return TAG_OCCU;
+
+    case PACK('H', 'U', 'S', 'B'):
+	return TAG_HUSB;
+
+    case PACK('W', 'I', 'F', 'E'):
+	return TAG_WIFE;
+
+    case PACK('C', 'H', 'I', 'L'):
+	return TAG_CHIL;
+
+    case PACK('M', 'A', 'R', 'R'):
+	return TAG_MARR;
+
+    case PACK('D', 'I', 'V', 0):
+	return TAG_DIV;
+
+    case PACK('G', 'I', 'V', 'N'):
+	return TAG_GIVN;
+
+    case PACK('S', 'U', 'R', 'N'):
+	return TAG_SURN;
+
+    case PACK('N', 'I', 'C', 'K'):
+	return TAG_NICK;
+
+    case PACK('D', 'A', 'T', 'E'):
+	return TAG_DATE;
+
+    case PACK('P', 'L', 'A', 'C'):
+	return TAG_PLAC;
+    }
+
+    return TAG_NONE;
+}
+
+// Hash GEDCOM xrefs, FNV-1a
+
+unsigned int hash_xref(view xref)
+{
+    unsigned int hash = 2166136261u;
+
+    for (int i = 0; i < xref.n; i++)
+    {
+	hash ^= (unsigned char)xref.p[i];
+	hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+// Add an id to a hash index, doubling the index when half full
+
+int insert_index(xindex *index, unsigned int hash, int id)
+{
+    if ((index->count + 1) * 2 > index->size)
+    {
+	int size = (index->size == 0)? SIZE_HASH: index->size * 2;
+	slot *slots = calloc(size, sizeof(slot));
+
+	if (slots == NULL)
+	    return GPDF_ERROR;
+
+	// Rehash from the stored hashes, the records aren't touched
+
+	for (int i = 0; i < index->size; i++)
+	{
+	    if (index->slots[i].id > 0)
+	    {
+		unsigned int j = index->slots[i].hash & (size - 1);
+
+		while (slots[j].id > 0)
+		    j = (j + 1) & (size - 1);
+
+		slots[j] = index->slots[i];
+	    }
+	}
+
+	free(index->slots);
+	index->slots = slots;
+	index->size = size;
+    }
+
+    unsigned int i = hash & (index->size - 1);
+
+    while (index->slots[i].id > 0)
+	i = (i + 1) & (index->size - 1);
+
+    index->slots[i].hash = hash;
+    index->slots[i].id = id;
+    index->count++;
+
+    return GPDF_SUCCESS;
+}
+
+// Find a string in the pool index, return its offset or 0
+
+int lookup_string(gpdf_context *ctx, view token, unsigned int hash)
+{
+    xindex *index = &ctx->strhash;
+
+    for (unsigned int i = hash & (index->size - 1);
+	 (index->size > 0) && (index->slots[i].id > 0);
+	 i = (i + 1) & (index->size - 1))
+    {
+	char *p = string(ctx, index->slots[i].id);
+
+	// If found return offset
+
+	if ((index->slots[i].hash == hash) &&
+	    (strncmp(p, token.p, token.n) == 0) && (p[token.n] == '\0'))
+	    return index->slots[i].id;
+    }
+
+    return 0;
+}
+
+// Add a token to the pool only if it isn't there already, places,
+// dates and occupations repeat a lot. The index holds pool offsets
+
+int intern_string(gpdf_context *ctx, int *field, view token)
+{
+    xindex *index = &ctx->strhash;
+    unsigned int hash;
+
+    // Leave empty strings at offset 0
+
+    if (token.n == 0)
+    {
+	*field = 0;
+	return GPDF_SUCCESS;
+    }
+
+    hash = hash_xref(token);
+    ctx->interns++;
+
+    // If found use it
+
+    *field = lookup_string(ctx, token, hash);
+
+    if (*field > 0)
+    {
+	ctx->shared++;
+	ctx->saved += token.n + 1;
+	return GPDF_SUCCESS;
+    }
+
+    if (copy_string(ctx, field, token) != GPDF_SUCCESS)
+	return GPDF_ERROR;
+
+    return insert_index(index, hash, *field);
+}
+
+// Resolve GEDCOM xrefs, lookups never add a record
+
+int lookup_individual(gpdf_context *ctx, view xref, unsigned int hash,
+		      int *probes)
+{
+    xindex *index = &ctx->indhash;
+
+    // Probe the index, an empty slot ends the search
+
+    for (unsigned int i = hash & (index->size - 1);
+	 (index->size > 0) && (index->slots[i].id > 0);
+	 i = (i + 1) & (index->size - 1))
+    {
+	int id = index->slots[i].id;
+
+	(*probes)++;
+
+	// If found return id
+
+	if ((index->slots[i].hash == hash) &&
+	    (strncmp(string(ctx, individual_text(ctx, id)->xref), xref.p,
+		     xref.n) == 0) &&
+	    (string(ctx, individual_text(ctx, id)->xref)[xref.n] == '\0'))
+	    return id;
+    }
+
+    return 0;
+}
+
+int lookup_family(gpdf_context *ctx, view xref, unsigned int hash,
+		  int *probes)
+{
+    xindex *index = &ctx->famhash;
+
+    // Probe the index, an empty slot ends the search
+
+    for (unsigned int i = hash & (index->size - 1);
+	 (index->size > 0) && (index->slots[i].id > 0);
+	 i = (i + 1) & (index->size - 1))
+    {
+	int id = index->slots[i].id;
+
+	(*probes)++;
+
+	// If found return id
+
+	if ((index->slots[i].hash == hash) &&
+	    (strncmp(string(ctx, family_text(ctx, id)->xref), xref.p,
+		     xref.n) == 0) &&
+	    (string(ctx, family_text(ctx, id)->xref)[xref.n] == '\0'))
+	    return id;
+    }
+
+    return 0;
+}
+
+int find_individual(gpdf_context *ctx, view xref)
+{
+    unsigned int hash = hash_xref(xref);
+    int id;
+
+    ctx->lookups++;
+
+    // If found return id
+
+    id = lookup_individual(ctx, xref, hash, &ctx->probes);
+
+    if (id > 0)
+	return id;
+
+    // Use next slot, save xref and hash, and return id
+
+    indi *indp = arena_alloc(&ctx->inds, ctx->indindex);
+    itext *textp = arena_alloc(&ctx->indtext, ctx->indindex);
+
+    if ((indp == NULL) || (textp == NULL) ||
+	(copy_string(ctx, &textp->xref, xref) != GPDF_SUCCESS) ||
+	(insert_index(&ctx->indhash, hash, ctx->indindex) != GPDF_SUCCESS))
+	return 0;
+
+    indp->id = ctx->indindex;
+    textp->hash = hash;
+    return ctx->indindex++;
+}
+
+int find_family(gpdf_context *ctx, view xref)
+{
+    unsigned int hash = hash_xref(xref);
+    int id;
+
+    ctx->lookups++;
+
+    // If found return id
+
+    id = lookup_family(ctx, xref, hash, &ctx->probes);
+
+    if (id > 0)
+	return id;
+
+    // Use next slot, save xref and hash, and return id
+
+    faml *famp = arena_alloc(&ctx->fams, ctx->famindex);
+    ftext *textp = arena_alloc(&ctx->famtext, ctx->famindex);
+
+    if ((famp == NULL) || (textp == NULL) ||
+	(copy_string(ctx, &textp->xref, xref) != GPDF_SUCCESS) ||
+	(insert_index(&ctx->famhash, hash, ctx->famindex) != GPDF_SUCCESS))
+	return 0;
+
+    famp->id = ctx->famindex;
+    textp->hash = hash;
+    return ctx->famindex++;
+}
+
+// Map the whole input file into memory, writable for snapshots, where
+// the changes stay private to this process
+
+char *map_file(char *filename, size_t *size, bool write)
+{
+#ifndef __MINGW32__
+    struct stat st;
+    char *data;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+
+    if (fd < 0)
+	return NULL;
+
+    if (fstat(fd, &st) < 0)
+    {
+	close(fd);
+	return NULL;
+    }
+
+    *size = st.st_size;
+
+    // Can't map an empty file
+
+    if (*size == 0)
+    {
+	close(fd);
+	return "";
+    }
+
+    data = mmap(NULL, *size, write? PROT_READ | PROT_WRITE: PROT_READ,
+		MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+	return NULL;
+
+    if (!write)
+	madvise(data, *size, MADV_SEQUENTIAL);
+
+    return data;
+#else
+    // No mmap() on windows, so read it all in
+
+    (void)write;
+    FILE *infile;
+    char *data;
+
+    infile = fopen(filename, "rb");
+
+    if (infile == NULL)
+	return NULL;
+
+    fseek(infile, 0, SEEK_END);
+    *size = ftell(infile);
+    fseek(infile, 0, SEEK_SET);
+
+    data = malloc(*size + 1);
+
+    if ((data != NULL) && (fread(data, 1, *size, infile) != *size))
+    {
+	free(data);
+	data = NULL;
+    }
+
+    fclose(infile);
+
+    return data;
+#endif
+}
+
+void unmap_file(char *data, size_t size)
+{
+#ifndef __MINGW32__
+    if (size > 0)
+	munmap(data, size);
+#else
+    (void)size;
+    free(data);
+#endif
+}
+
+// Hash the input in four lanes a word at a time, to tell if it has
+// changed under the same size and time
+
+unsigned long long hash_data(char *data, size_t size)
+{
+    unsigned long long lanes[4] = {1, 2, 3, 4};
+    unsigned long long hash = size;
+    size_t i;
+
+    for (i = 0; i + 32 <= size; i += 32)
+    {
+	for (int l = 0; l < 4; l++)
+	{
+	    unsigned long long word;
+
+	    memcpy(&word, data + i + (l * 8), sizeof(word));
+	    lanes[l] = (lanes[l] ^ word) * 0x9e3779b97f4a7c15ULL;
+	    lanes[l] ^= lanes[l] >> 32;
+	}
+    }
+
+    for (; i < size; i++)
+	lanes[0] = (lanes[0] ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+
+    for (int l = 0; l < 4; l++)
+	hash = (hash ^ lanes[l]) * 0x9e3779b97f4a7c15ULL;
+
+    return hash;
+}
+
+// Fill in the header fields that say which input a snapshot is of.
+// The size and time are enough to tell, hashing the contents means
+// reading the whole input, so it is only done when asked
+
+int snapshot_key(char *filename, snaphead *head, bool hash)
+{
+    struct stat st;
+
+    if (stat(filename, &st) < 0)
+	return GPDF_ERROR;
+
+    memcpy(head->magic, SNAP_MAGIC, sizeof(head->magic));
+    head->version = SNAP_VERSION;
+    head->sizes[0] = sizeof(indi);
+    head->sizes[1] = sizeof(faml);
+    head->sizes[2] = sizeof(itext);
+    head->sizes[3] = sizeof(ftext);
+    head->filesize = st.st_size;
+    head->mtime = st.st_mtime;
+
+    if (hash)
+    {
+	size_t size;
+	char *data = map_file(filename, &size, false);
+
+	if (data == NULL)
+	    return GPDF_ERROR;
+
+	head->hash = hash_data(data, size);
+	unmap_file(data, size);
+    }
+
+    return GPDF_SUCCESS;
+}
+
+// Pad the snapshot so the next section starts aligned
+
+void pad_section(FILE *snapfile)
+{
+    static const char pad[SIZE_ALIGN];
+
+    if (ftell(snapfile) % SIZE_ALIGN)
+	fwrite(pad, 1, SIZE_ALIGN - (ftell(snapfile) % SIZE_ALIGN), snapfile);
+}
+
+void write_section(FILE *snapfile, snaphead *head, int section,
+		   void *data, size_t size)
+{
+    head->offsets[section] = ftell(snapfile);
+    fwrite(data, 1, size, snapfile);
+    pad_section(snapfile);
+}
+
+// Write the records of an arena in id order, one chunk after another,
+// so the chunks can point into the snapshot
+
+void write_arena(FILE *snapfile, snaphead *head, int section,
+		 arena *arena, int count)
+{
+    head->offsets[section] = ftell(snapfile);
+
+    for (int i = 0; (i < SIZE_CHUNKS) &&
+	     (arena->base * ((1 << i) - 1) < count); i++)
+    {
+	int first = arena->base * ((1 << i) - 1);
+	int n = (first + (arena->base << i) < count)?
+	    arena->base << i: count - first;
+
+	fwrite(arena->chunks[i], arena->size, n, snapfile);
+    }
+
+    pad_section(snapfile);
+}
+
+// Write the rows of a graph, the index followed by the list
+
+void write_csr(FILE *snapfile, snaphead *head, int section, csr *csr,
+	       int n)
+{
+    head->offsets[section] = ftell(snapfile);
+    fwrite(csr->index, sizeof(int), n + 1, snapfile);
+    fwrite(csr->list, sizeof(int), csr->index[n], snapfile);
+    pad_section(snapfile);
+}
+
+// Turn ids saved in the links between records back into pointers
+
+void link_records(gpdf_context *ctx)
+{
+    for (int i = 1; i < ctx->indindex; i++)
+    {
+	indi *indp = individual(ctx, i);
+
+	if (indp->famc != NULL)
+	    indp->famc = family(ctx, (intptr_t)indp->famc);
+    }
+
+    for (int i = 1; i < ctx->famindex; i++)
+    {
+	faml *famp = family(ctx, i);
+
+	if (famp->husb != NULL)
+	    famp->husb = individual(ctx, (intptr_t)famp->husb);
+
+	if (famp->wife != NULL)
+	    famp->wife = individual(ctx, (intptr_t)famp->wife);
+    }
+}
+
+// Save the parsed tree next to the input, with the records, strings,
+// xref index and graph in sections that can be mapped straight back.
+// Links between records are saved as ids. It is written to a temporary
+// file first so a snapshot is never seen half written
+
+int save_snapshot(gpdf_context *ctx, char *filename)
+{
+    char snapname[SIZE_LINE];
+    char tempname[SIZE_LINE];
+    snaphead head = {};
+    FILE *snapfile;
+    int status;
+
+    if (snapshot_key(filename, &head, true) != GPDF_SUCCESS)
+	return GPDF_ERROR;
+
+    snprintf(snapname, sizeof(snapname), "%s.snap", filename);
+    snprintf(tempname, sizeof(tempname), "%s.snap.tmp", filename);
+
+    snapfile = fopen(tempname, "wb");
+
+    if (snapfile == NULL)
+    {
+	fprintf(stderr, "%s: can't write to %s\n", progname, tempname);
+	return GPDF_ERROR;
+    }
+
+    head.indindex = ctx->indindex;
+    head.famindex = ctx->famindex;
+    head.hashsize = ctx->indhash.size;
+    head.hashcount = ctx->indhash.count;
+    head.famsize = ctx->famhash.size;
+    head.famcount = ctx->famhash.count;
+    head.strsize = ctx->strhash.size;
+    head.strcount = ctx->strhash.count;
+    strcpy(head.file, ctx->file);
+
+    write_section(snapfile, &head, SNAP_SECTIONS, &head, sizeof(head));
+
+    // Swap the links for ids while writing, then put them back
+
+    for (int i = 1; i < ctx->indindex; i++)
+    {
+	indi *indp = individual(ctx, i);
+
+	if (indp->famc != NULL)
+	    indp->famc = (faml *)(intptr_t)indp->famc->id;
+    }
+
+    for (int i = 1; i < ctx->famindex; i++)
+    {
+	faml *famp = family(ctx, i);
+
+	if (famp->husb != NULL)
+	    famp->husb = (indi *)(intptr_t)famp->husb->id;
+
+	if (famp->wife != NULL)
+	    famp->wife = (indi *)(intptr_t)famp->wife->id;
+    }
+
+    write_arena(snapfile, &head, SNAP_INDS, &ctx->inds, ctx->indindex);
+    write_arena(snapfile, &head, SNAP_FAMS, &ctx->fams, ctx->famindex);
+
+    link_records(ctx);
+
+    write_arena(snapfile, &head, SNAP_INDTEXT, &ctx->indtext,
+		ctx->indindex);
+    write_arena(snapfile, &head, SNAP_FAMTEXT, &ctx->famtext,
+		ctx->famindex);
+    write_section(snapfile, &head, SNAP_STRINGS, ctx->strings.data,
+		  ctx->strings.used);
+    write_section(snapfile, &head, SNAP_INDHASH, ctx->indhash.slots,
+		  ctx->indhash.size * sizeof(slot));
+    write_section(snapfile, &head, SNAP_FAMHASH, ctx->famhash.slots,
+		  ctx->famhash.size * sizeof(slot));
+    write_section(snapfile, &head, SNAP_STRHASH, ctx->strhash.slots,
+		  ctx->strhash.size * sizeof(slot));
+    write_csr(snapfile, &head, SNAP_PARENTS, &ctx->parents, ctx->indindex);
+    write_csr(snapfile, &head, SNAP_SPOUSES, &ctx->spouses, ctx->indindex);
+    write_csr(snapfile, &head, SNAP_FAMILIES, &ctx->families,
+	      ctx->indindex);
+    write_csr(snapfile, &head, SNAP_CHILDREN, &ctx->children,
+	      ctx->famindex);
+
+    head.strings = ctx->strings.used;
+    head.total = ftell(snapfile);
+
+    // Write the header again with the offsets filled in
+
+    rewind(snapfile);
+    fwrite(&head, sizeof(head), 1, snapfile);
+
+    status = (ferror(snapfile) || (fclose(snapfile) != 0))?
+	GPDF_ERROR: GPDF_SUCCESS;
+
+    if ((status != GPDF_SUCCESS) || (rename(tempname, snapname) != 0))
+    {
+	fprintf(stderr, "%s: can't write to %s\n", progname, snapname);
+	remove(tempname);
+	return GPDF_ERROR;
+    }
+
+    return GPDF_SUCCESS;
+}
+
+// Point an arena at its records in the snapshot
+
+void load_arena(arena *arena, char *data, int count)
+{
+    for (int i = 0; (i < SIZE_CHUNKS) &&
+	     (arena->base * ((1 << i) - 1) < count); i++)
+	arena->chunks[i] = data +
+	    ((size_t)arena->base * ((1 << i) - 1) * arena->size);
+}
+
+// Point the rows of a graph at the snapshot
+
+void load_csr(csr *csr, char *data, int n)
+{
+    csr->index = (int *)data;
+    csr->list = csr->index + n + 1;
+}
+
+// Check a section of a snapshot holds count items of a size and lies
+// inside the file
+
+bool check_section(snaphead *head, size_t size, int section,
+		   long long count, size_t each)
+{
+    long long offset = head->offsets[section];
+
+    return (offset >= (long long)sizeof(snaphead)) &&
+	(offset <= (long long)size) && (offset % SIZE_ALIGN == 0) &&
+	(count >= 0) && ((size_t)count <= (size - offset) / each);
+}
+
+// The rows of a graph are checked in two steps, the index says how
+// long the list after it is
+
+bool check_csr(char *data, size_t size, int section, int n)
+{
+    snaphead *head = (snaphead *)data;
+    int *index;
+
+    if ((n < 0) || !check_section(head, size, section, n + 1LL, sizeof(int)))
+	return false;
+
+    index = (int *)(data + head->offsets[section]);
+
+    return check_section(head, size, section, n + 1LL + index[n],
+			 sizeof(int)) && (index[n] >= 0);
+}
+
+// Check the sections of a snapshot against its size, so a snapshot cut
+// short or written wrong is parsed again rather than read past its end
+
+bool check_snapshot(char *data, size_t size)
+{
+    snaphead *head = (snaphead *)data;
+
+    return (memchr(head->file, '\0', sizeof(head->file)) != NULL) &&
+	check_section(head, size, SNAP_INDS, head->indindex, sizeof(indi)) &&
+	check_section(head, size, SNAP_FAMS, head->famindex, sizeof(faml)) &&
+	check_section(head, size, SNAP_INDTEXT, head->indindex,
+		      sizeof(itext)) &&
+	check_section(head, size, SNAP_FAMTEXT, head->famindex,
+		      sizeof(ftext)) &&
+	check_section(head, size, SNAP_STRINGS, head->strings, 1) &&
+	check_section(head, size, SNAP_INDHASH, head->hashsize,
+		      sizeof(slot)) &&
+	check_section(head, size, SNAP_FAMHASH, head->famsize,
+		      sizeof(slot)) &&
+	check_section(head, size, SNAP_STRHASH, head->strsize,
+		      sizeof(slot)) &&
+	check_csr(data, size, SNAP_PARENTS, head->indindex) &&
+	check_csr(data, size, SNAP_SPOUSES, head->indindex) &&
+	check_csr(data, size, SNAP_FAMILIES, head->indindex) &&
+	check_csr(data, size, SNAP_CHILDREN, head->famindex);
+}
+
+// Load the parsed tree from the snapshot next to the input if it is of
+// the same input, mapping it rather than reading it, so there is no
+// parsing at all. The mapping is private, so changes to the records
+// don't go back to the file. Drawing adds strings, so the pool and its
+// index are copied out where they can grow
+
+int load_snapshot(gpdf_context *ctx, char *filename)
+{
+    char snapname[SIZE_LINE];
+    snaphead key = {};
+    snaphead *head;
+    size_t size;
+    char *data;
+    char *strings;
+    slot *slots;
+
+    snprintf(snapname, sizeof(snapname), "%s.snap", filename);
+
+    if (access(snapname, R_OK) != 0)
+	return GPDF_ERROR;
+
+    if (snapshot_key(filename, &key, false) != GPDF_SUCCESS)
+	return GPDF_ERROR;
+
+    data = map_file(snapname, &size, true);
+
+    if (data == NULL)
+	return GPDF_ERROR;
+
+    head = (snaphead *)data;
+
+    // Check the snapshot is whole and of this input, only hashing the
+    // input if it has been touched since
+
+    if ((size < sizeof(snaphead)) || (head->total != (long long)size) ||
+	(memcmp(head, &key, offsetof(snaphead, mtime)) != 0) ||
+	!check_snapshot(data, size) ||
+	((head->mtime != key.mtime) &&
+	 ((snapshot_key(filename, &key, true) != GPDF_SUCCESS) ||
+	  (head->hash != key.hash))))
+    {
+	unmap_file(data, size);
+	return GPDF_ERROR;
+    }
+
+    // Keep the new time, so the input isn't hashed again next time
+
+    if (head->mtime != key.mtime)
+    {
+	FILE *snapfile = fopen(snapname, "r+b");
+
+	if (snapfile != NULL)
+	{
+	    fseek(snapfile, offsetof(snaphead, mtime), SEEK_SET);
+	    fwrite(&key.mtime, sizeof(key.mtime), 1, snapfile);
+	    fclose(snapfile);
+	}
+    }
+
+    strings = malloc(head->strings);
+    slots = malloc(head->strsize * sizeof(slot));
+
+    if ((strings == NULL) || ((slots == NULL) && (head->strsize > 0)))
+    {
+	free(strings);
+	free(slots);
+	unmap_file(data, size);
+	return GPDF_ERROR;
+    }
+
+    // Everything the passes after parsing need, and nothing else
+
+    ctx->snapshot = data;
+    ctx->snapsize = size;
+    ctx->indindex = head->indindex;
+    ctx->famindex = head->famindex;
+    ctx->bytes = size;
+    strcpy(ctx->file, head->file);
+
+    free(ctx->strings.data);
+    ctx->strings.data = strings;
+    ctx->strings.size = ctx->strings.used = head->strings;
+    memcpy(strings, data + head->offsets[SNAP_STRINGS], head->strings);
+
+    ctx->strhash.slots = slots;
+    ctx->strhash.size = head->strsize;
+    ctx->strhash.count = head->strcount;
+    memcpy(slots, data + head->offsets[SNAP_STRHASH],
+	   head->strsize * sizeof(slot));
+
+    ctx->indhash.slots = (slot *)(data + head->offsets[SNAP_INDHASH]);
+    ctx->indhash.size = head->hashsize;
+    ctx->indhash.count = head->hashcount;
+
+    ctx->famhash.slots = (slot *)(data + head->offsets[SNAP_FAMHASH]);
+    ctx->famhash.size = head->famsize;
+    ctx->famhash.count = head->famcount;
+
+    load_arena(&ctx->inds, data + head->offsets[SNAP_INDS], ctx->indindex);
+    load_arena(&ctx->fams, data + head->offsets[SNAP_FAMS], ctx->famindex);
+    load_arena(&ctx->indtext, data + head->offsets[SNAP_INDTEXT],
+	       ctx->indindex);
+    load_arena(&ctx->famtext, data + head->offsets[SNAP_FAMTEXT],
+	       ctx->famindex);
+
+    load_csr(&ctx->parents, data + head->offsets[SNAP_PARENTS],
+	     ctx->indindex);
+    load_csr(&ctx->spouses, data + head->offsets[SNAP_SPOUSES],
+	     ctx->indindex);
+    load_csr(&ctx->families, data + head->offsets[SNAP_FAMILIES],
+	     ctx->indindex);
+    load_csr(&ctx->children, data + head->offsets[SNAP_CHILDREN],
+	     ctx->famindex);
+
+    link_records(ctx);
+
+    return GPDF_SUCCESS;
+}
+
+// Let go of the snapshot, and forget everything that points into it
+
+void unload_snapshot(gpdf_context *ctx)
+{
+    unmap_file(ctx->snapshot, ctx->snapsize);
+
+    memset(ctx->inds.chunks, 0, sizeof(ctx->inds.chunks));
+    memset(ctx->fams.chunks, 0, sizeof(ctx->fams.chunks));
+    memset(ctx->indtext.chunks, 0, sizeof(ctx->indtext.chunks));
+    memset(ctx->famtext.chunks, 0, sizeof(ctx->famtext.chunks));
+
+    ctx->indhash.slots = NULL;
+    ctx->famhash.slots = NULL;
+    ctx->parents = ctx->spouses = ctx->families = ctx->children = (csr){};
+    ctx->snapshot = NULL;
+}
+
+// Characters allowed in a value, as the scanf set [0-9a-zA-Z /@-]
+
+bool is_value(char c)
+{
+    return ((c >= '0') && (c <= '9')) || ((c >= 'a') && (c <= 'z')) ||
+	((c >= 'A') && (c <= 'Z')) || (c == ' ') || (c == '/') ||
+	(c == '@') || (c == '-');
+}
+
+// Find the end of a line and the first two spaces in it, a vector at a
+// time where the machine has them. Spaces are the isspace() set
+
+void scan_mask(char *p, unsigned int nl, unsigned int ws,
+	       char *spaces[2], int *n)
+{
+    // Only spaces before the newline count
+
+    if (nl != 0)
+	ws &= (nl & -nl) - 1;
+
+    while ((ws != 0) && (*n < 2))
+    {
+	spaces[(*n)++] = p + __builtin_ctz(ws);
+	ws &= ws - 1;
+    }
+}
+
+char *scan_line(char *p, char *end, char *spaces[2])
+{
+    int n = 0;
+
+    spaces[0] = NULL;
+    spaces[1] = NULL;
+
+#if defined(__AVX2__)
+    __m256i newline = _mm256_set1_epi8('\n');
+    __m256i space = _mm256_set1_epi8(' ');
+    __m256i low = _mm256_set1_epi8('\t' - 1);
+    __m256i high = _mm256_set1_epi8('\r' + 1);
+
+    for (; p + 32 <= end; p += 32)
+    {
+	__m256i v = _mm256_loadu_si256((__m256i *)p);
+	__m256i ctrl = _mm256_and_si256(_mm256_cmpgt_epi8(v, low),
+					_mm256_cmpgt_epi8(high, v));
+	unsigned int nl =
+	    _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline));
+	unsigned int ws =
+	    _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+						 ctrl)) & ~nl;
+
+	scan_mask(p, nl, ws, spaces, &n);
+
+	if (nl != 0)
+	    return p + __builtin_ctz(nl);
+    }
+#elif defined(__SSE2__)
+    __m128i newline = _mm_set1_epi8('\n');
+    __m128i space = _mm_set1_epi8(' ');
+    __m128i low = _mm_set1_epi8('\t' - 1);
+    __m128i high = _mm_set1_epi8('\r' + 1);
+
+    for (; p + 16 <= end; p += 16)
+    {
+	__m128i v = _mm_loadu_si128((__m128i *)p);
+	__m128i ctrl = _mm_and_si128(_mm_cmpgt_epi8(v, low),
+				     _mm_cmpgt_epi8(high, v));
+	unsigned int nl = _mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+	unsigned int ws =
+	    _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, space),
+					   ctrl)) & ~nl;
+
+	scan_mask(p, nl, ws, spaces, &n);
+
+	if (nl != 0)
+	    return p + __builtin_ctz(nl);
+    }
+#endif
+
+    // The rest a byte at a time
+
+    for (; p < end; p++)
+    {
+	if (*p == '\n')
+	    return p;
+
+	if (isspace((unsigned char)*p) && (n < 2))
+	    spaces[n++] = p;
+    }
+
+    return end;
+}
+
+// Split a line into level, tag and value tokens in place
+
+int split_line(char *p, char *end, view *first, view *second)
+{
+    int type = 0;
+
+    // Level
+
+    while ((p < end) && isspace((unsigned char)*p))
+	p++;
+
+    if ((p == end) || !isdigit((unsigned char)*p))
+	return type;
+
+    while ((p < end) && isdigit((unsigned char)*p))
+	type = (type * 10) + (*p++ - '0');
+
+    // Tag
+
+    while ((p < end) && isspace((unsigned char)*p))
+	p++;
+
+    first->p = p;
+    while ((p < end) && !isspace((unsigned char)*p))
+	p++;
+    first->n = p - first->p;
+
+    // Value
+
+    while ((p < end) && isspace((unsigned char)*p))
+	p++;
+
+    second->p = p;
+    while ((p < end) && is_value(*p))
+	p++;
+    second->n = p - second->p;
+
+    return type;
+}
+
+// Split a line using the spaces found by scan_line(), anything that
+// isn't a plain "level tag value" line goes to split_line()
+
+int split_fields(char *p, char *end, char *spaces[2],
+		 view *first, view *second)
+{
+    int type = 0;
+
+    if ((spaces[0] == NULL) || (spaces[0] == p) ||
+	(spaces[1] == spaces[0] + 1))
+	return split_line(p, end, first, second);
+
+    // Level
+
+    for (char *q = p; q < spaces[0]; q++)
+    {
+	if (!isdigit((unsigned char)*q))
+	    return split_line(p, end, first, second);
+
+	type = (type * 10) + (*q - '0');
+    }
+
+    // Tag
+
+    first->p = spaces[0] + 1;
+    first->n = ((spaces[1] != NULL)? spaces[1]: end) - first->p;
+
+    // Value
+
+    if (spaces[1] != NULL)
+    {
+	p = spaces[1];
+
+	while ((p < end) && isspace((unsigned char)*p))
+	    p++;
+
+	second->p = p;
+	while ((p < end) && is_value(*p))
+	    p++;
+	second->n = p - second->p;
+    }
+
+    return type;
+}
+
+// Parse the lines from start up to end
+
+int parse_lines(gpdf_context *ctx, char *start, char *end)
+{
+    int status = GPDF_SUCCESS;
+
+    // Get lines
+
+    for (char *line = start; line < end;)
+    {
+	char *spaces[2];
+	char *next = scan_line(line, end, spaces);
+	view first = {"", 0};
+	view second = {"", 0};
+	int type;
+
+	// Parse fields
+
+	type = split_fields(line, next, spaces, &first, &second);
+
+	// Check record type
+
+	switch (type)
+	{
+	case TYPE_OBJECT:
+	    status = object(ctx, first, second);
+	    break;
+
+	case TYPE_PROP:
+	    status = property(ctx, first, second);
+	    break;
+
+	case TYPE_ATTR:
+	    status = attrib(ctx, first, second);
+	    break;
+	}
+
+	if (status != GPDF_SUCCESS)
+	    break;
+
+	line = next + 1;
+    }
+
+    return status;
+}
+
+// Run a parse stage on each chunk in its own thread
+
+int run_chunks(chunk *chunks, int n, void *(*stage)(void *))
+{
+    pthread_t tids[SIZE_THREADS];
+    int status = GPDF_SUCCESS;
+
+    for (int i = 0; i < n; i++)
+	if (pthread_create(&tids[i], NULL, stage, &chunks[i]) != 0)
+	    return GPDF_ERROR;
+
+    for (int i = 0; i < n; i++)
+    {
+	pthread_join(tids[i], NULL);
+
+	if (chunks[i].status != GPDF_SUCCESS)
+	    status = GPDF_ERROR;
+    }
+
+    return status;
+}
+
+// Parse a chunk into its own records. Any xrefs that aren't defined
+// in the chunk are left as empty records to be linked up later
+
+void *parse_chunk(void *arg)
+{
+    chunk *chp = arg;
+
+    init_context(&chp->ctx);
+    chp->status = parse_lines(&chp->ctx, chp->start, chp->end);
+
+    return NULL;
+}
+
+// Find where a string from a chunk is in the pool, strings found in
+// more than one chunk are only used from the first
+
+int chunk_string(chunk *chp, int field)
+{
+    char *p = string(&chp->ctx, field);
+    view token = {p, strlen(p)};
+
+    return lookup_string(chp->global, token, hash_xref(token));
+}
+
+// Copy the fields set in a chunk's record over the final record. A
+// record defined again later in the file is merged the same way, so
+// the fields come out as if the file were parsed in one go
+
+void merge_individual(chunk *chp, int id)
+{
+    gpdf_context *ctx = &chp->ctx;
+    indi *indp = individual(ctx, id);
+    itext *textp = individual_text(ctx, id);
+    indi *globp = individual(chp->global, chp->indmap[id]);
+    itext *globt = individual_text(chp->global, chp->indmap[id]);
+    int *fields[] = {&globt->name, &globt->givn, &globt->surn,
+		     &globt->marn, &globt->nick, &globt->occu,
+		     &globt->birt.date, &globt->birt.plac,
+		     &globt->deat.date, &globt->deat.plac};
+    int values[] = {textp->name, textp->givn, textp->surn,
+		    textp->marn, textp->nick, textp->occu,
+		    textp->birt.date, textp->birt.plac,
+		    textp->deat.date, textp->deat.plac};
+
+    globp->defn = true;
+
+    if (indp->sex != '\0')
+	globp->sex = indp->sex;
+
+    if (indp->nchi != 0)
+	globp->nchi = indp->nchi;
+
+    if (indp->famc != NULL)
+	globp->famc = family(chp->global, chp->fammap[indp->famc->id]);
+
+    for (int i = 0; i < (int)(sizeof(values) / sizeof(int)); i++)
+	if (values[i] != 0)
+	    *fields[i] = chunk_string(chp, values[i]);
+
+    globt->birt.yes |= textp->birt.yes;
+    globt->deat.yes |= textp->deat.yes;
+}
+
+void merge_family(chunk *chp, int id)
+{
+    gpdf_context *ctx = &chp->ctx;
+    faml *famp = family(ctx, id);
+    ftext *textp = family_text(ctx, id);
+    faml *globp = family(chp->global, chp->fammap[id]);
+    ftext *globt = family_text(chp->global, chp->fammap[id]);
+    int *fields[] = {&globt->marr.date, &globt->marr.plac,
+		     &globt->divc.date, &globt->divc.plac};
+    int values[] = {textp->marr.date, textp->marr.plac,
+		    textp->divc.date, textp->divc.plac};
+
+    globp->defn = true;
+
+    if (famp->husb != NULL)
+	globp->husb = individual(chp->global, chp->indmap[famp->husb->id]);
+
+    if (famp->wife != NULL)
+	globp->wife = individual(chp->global, chp->indmap[famp->wife->id]);
+
+    for (int i = 0; i < (int)(sizeof(values) / sizeof(int)); i++)
+	if (values[i] != 0)
+	    *fields[i] = chunk_string(chp, values[i]);
+
+    globt->marr.yes |= textp->marr.yes;
+    globt->divc.yes |= textp->divc.yes;
+}
+
+// Copy the records first defined in a chunk into their places,
+// pointing their links at the final records. Each of those records
+// only comes from one chunk, so the threads don't touch the same ones
+
+void *link_chunk(void *arg)
+{
+    chunk *chp = arg;
+    gpdf_context *ctx = &chp->ctx;
+    gpdf_context *global = chp->global;
+
+    for (int i = 1; i < ctx->indindex; i++)
+	if (individual(ctx, i)->defn && !chp->indmerge[i])
+	    merge_individual(chp, i);
+
+    for (int i = 1; i < ctx->famindex; i++)
+	if (family(ctx, i)->defn && !chp->fammerge[i])
+	    merge_family(chp, i);
+
+    // Copy the links into this chunk's place in the list, which
+    // keeps them in file order
+
+    for (int i = 0; i < ctx->nedges; i++)
+    {
+	edge *edgep = &ctx->edges[i];
+	edge *globp = &global->edges[chp->offset + i];
+
+	globp->type = edgep->type;
+
+	switch (edgep->type)
+	{
+	case LINK_FAMS:
+	    globp->from = chp->indmap[edgep->from];
+	    globp->to = chp->fammap[edgep->to];
+	    break;
+
+	case LINK_CHIL:
+	    globp->from = chp->fammap[edgep->from];
+	    globp->to = chp->indmap[edgep->to];
+	    break;
+	}
+    }
+
+    return NULL;
+}
+
+// Add the records in a chunk to the index in the order the chunk
+// first mentions them. Taking the chunks in file order gives the
+// same ids as parsing the file in one go
+
+int index_chunk(gpdf_context *ctx, chunk *chp)
+{
+    gpdf_context *chctx = &chp->ctx;
+
+    chp->indmap = calloc(chctx->indindex, sizeof(int));
+    chp->fammap = calloc(chctx->famindex, sizeof(int));
+    chp->indmerge = calloc(chctx->indindex, sizeof(bool));
+    chp->fammerge = calloc(chctx->famindex, sizeof(bool));
+
+    if ((chp->indmap == NULL) || (chp->fammap == NULL) ||
+	(chp->indmerge == NULL) || (chp->fammerge == NULL))
+	return GPDF_ERROR;
+
+    for (int i = 1; i < chctx->indindex; i++)
+    {
+	char *p = string(chctx, individual_text(chctx, i)->xref);
+	view xref = {p, strlen(p)};
+	int id = find_individual(ctx, xref);
+
+	if (id == 0)
+	    return GPDF_ERROR;
+
+	// Records defined in an earlier chunk are merged afterwards
+
+	if (individual(chctx, i)->defn)
+	{
+	    chp->indmerge[i] = individual(ctx, id)->defn;
+	    individual(ctx, id)->defn = true;
+	}
+
+	chp->indmap[i] = id;
+    }
+
+    for (int i = 1; i < chctx->famindex; i++)
+    {
+	char *p = string(chctx, family_text(chctx, i)->xref);
+	view xref = {p, strlen(p)};
+	int id = find_family(ctx, xref);
+
+	if (id == 0)
+	    return GPDF_ERROR;
+
+	if (family(chctx, i)->defn)
+	{
+	    chp->fammerge[i] = family(ctx, id)->defn;
+	    family(ctx, id)->defn = true;
+	}
+
+	chp->fammap[i] = id;
+    }
+
+    return GPDF_SUCCESS;
+}
+
+// Make room for a chunk's links and add its strings to the pool,
+// strings already found in an earlier chunk count as shared, the
+// same as when parsing in one go
+
+int place_chunk(gpdf_context *ctx, chunk *chp)
+{
+    gpdf_context *chctx = &chp->ctx;
+    xindex *index = &chctx->strhash;
+
+    if (grow_edges(ctx, chctx->nedges) != GPDF_SUCCESS)
+	return GPDF_ERROR;
+
+    chp->offset = ctx->nedges;
+    ctx->nedges += chctx->nedges;
+
+    for (int i = 0; i < index->size; i++)
+    {
+	int id = index->slots[i].id;
+
+	if (id > 0)
+	{
+	    char *p = string(chctx, id);
+	    view token = {p, strlen(p)};
+	    int field;
+
+	    if (lookup_string(ctx, token, index->slots[i].hash) > 0)
+	    {
+		ctx->shared++;
+		ctx->saved += token.n + 1;
+	    }
+
+	    else if ((copy_string(ctx, &field, token) != GPDF_SUCCESS) ||
+		     (insert_index(&ctx->strhash, index->slots[i].hash,
+				   field) != GPDF_SUCCESS))
+		return GPDF_ERROR;
+	}
+    }
+
+    return GPDF_SUCCESS;
+}
+
+// Parse the file in chunks split at level 0 lines, one chunk to a
+// thread, then put the records together and link them up
+
+int parse_chunks(gpdf_context *ctx, char *data, size_t size)
+{
+    chunk chunks[SIZE_THREADS] = {};
+    char *end = data + size;
+    int status;
+
+    for (int i = 0; i < threads; i++)
+    {
+	char *p = data + (size * i / threads);
+
+	// Find the start of the next level 0 line
+
+	if (i > 0)
+	{
+	    while (((p = memchr(p, '\n', end - p)) != NULL) &&
+		   ((p + 2 >= end) || (p[1] != '0') || (p[2] != ' ')))
+		p++;
+
+	    p = (p == NULL)? end: p + 1;
+
+	    if (p < chunks[i - 1].start)
+		p = chunks[i - 1].start;
+
+	    chunks[i - 1].end = p;
+	}
+
+	chunks[i].start = p;
+	chunks[i].end = end;
+	chunks[i].global = ctx;
+    }
+
+    // Parse the chunks
+
+    status = run_chunks(chunks, threads, parse_chunk);
+
+    // Number the records, then add the strings and make room for the
+    // links
+
+    for (int i = 0; (i < threads) && (status == GPDF_SUCCESS); i++)
+	status = index_chunk(ctx, &chunks[i]);
+
+    // Count the lookups made numbering the records apart, so the index
+    // counts are those of the chunks' parses
+
+    ctx->merges = ctx->lookups;
+    ctx->mergeprobes = ctx->probes;
+    ctx->lookups = ctx->probes = 0;
+
+    for (int i = 0; (i < threads) && (status == GPDF_SUCCESS); i++)
+	status = place_chunk(ctx, &chunks[i]);
+
+    // Link the records, then merge any defined more than once in file
+    // order, so later fields replace earlier ones
+
+    if (status == GPDF_SUCCESS)
+	status = run_chunks(chunks, threads, link_chunk);
+
+    for (int i = 0; (i < threads) && (status == GPDF_SUCCESS); i++)
+    {
+	for (int j = 1; j < chunks[i].ctx.indindex; j++)
+	    if (chunks[i].indmerge[j])
+		merge_individual(&chunks[i], j);
+
+	for (int j = 1; j < chunks[i].ctx.famindex; j++)
+	    if (chunks[i].fammerge[j])
+		merge_family(&chunks[i], j);
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+	ctx->lookups += chunks[i].ctx.lookups;
+	ctx->probes += chunks[i].ctx.probes;
+	ctx->interns += chunks[i].ctx.interns;
+	ctx->shared += chunks[i].ctx.shared;
+	ctx->saved += chunks[i].ctx.saved;
+
+	// Keep the file name from the header
+
+	if ((ctx->file[0] == '\0') && (chunks[i].ctx.file[0] != '\0'))
+	    strcpy(ctx->file, chunks[i].ctx.file);
+
+	free(chunks[i].indmap);
+	free(chunks[i].fammap);
+	free(chunks[i].indmerge);
+	free(chunks[i].fammerge);
+	free_context(&chunks[i].ctx);
+    }
+
+    if (status != GPDF_SUCCESS)
+	fprintf(stderr, "%s: Can't find slots for records\n", progname);
+
+    return status;
+}
+
+int parse_gedcom_file(gpdf_context *ctx, char *filename)
+{
+    char *data;
+    size_t size;
+    int status;
+
+    // Map the file
+
+    data = map_file(filename, &size, false);
+
+    if (data == NULL)
+	return GPDF_ERROR;
+
+    ctx->bytes += size;
+
+    if (threads > 1)
+	status = parse_chunks(ctx, data, size);
+
+    else
+	status = parse_lines(ctx, data, data + size);
+
+    unmap_file(data, size);
+
+    // Build the family graph
+
+    if (status == GPDF_SUCCESS)
+	status = build_graph(ctx);
+
+    return status;
+}
+
+// Return the partner of an individual in a family, the wife for men
+// and the husband for everyone else
+
+indi *partner(indi *indp, faml *famp)
+{
+    return (indp->sex == 'M')? famp->wife: famp->husb;
+}
+
+// Build the parents, spouses and families of each individual and the
+// children of each family as compressed rows, once the records are
+// all linked, so the later passes don't have to look through slots
+
+int build_graph(gpdf_context *ctx)
+{
+    int ninds = ctx->indindex;
+    int nfams = ctx->famindex;
+
+    if ((start_csr(&ctx->parents, ninds) != GPDF_SUCCESS) ||
+	(start_csr(&ctx->spouses, ninds) != GPDF_SUCCESS) ||
+	(start_csr(&ctx->families, ninds) != GPDF_SUCCESS) ||
+	(start_csr(&ctx->children, nfams) != GPDF_SUCCESS))
+	return GPDF_ERROR;
+
+    // Count the rows
+
+    for (int i = 1; i < ninds; i++)
+    {
+	indi *indp = individual(ctx, i);
+
+	if (indp->famc != NULL)
+	    ctx->parents.index[i + 1] += (indp->famc->wife != NULL) +
+		(indp->famc->husb != NULL);
+    }
+
+    for (int i = 0; i < ctx->nedges; i++)
+    {
+	edge *edgep = &ctx->edges[i];
+
+	switch (edgep->type)
+	{
+	case LINK_FAMS:
+	    if (partner(individual(ctx, edgep->from),
+			family(ctx, edgep->to)) != NULL)
+		ctx->spouses.index[edgep->from + 1]++;
+
+	    ctx->families.index[edgep->from + 1]++;
+	    break;
+
+	case LINK_CHIL:
+	    ctx->children.index[edgep->from + 1]++;
+	    break;
+	}
+    }
+
+    if ((fill_csr(&ctx->parents, ninds) != GPDF_SUCCESS) ||
+	(fill_csr(&ctx->spouses, ninds) != GPDF_SUCCESS) ||
+	(fill_csr(&ctx->families, ninds) != GPDF_SUCCESS) ||
+	(fill_csr(&ctx->children, nfams) != GPDF_SUCCESS))
+	return GPDF_ERROR;
+
+    // Fill them in, mother first, then in file order
+
+    for (int i = 1; i < ninds; i++)
+    {
+	indi *indp = individual(ctx, i);
+
+	if (indp->famc != NULL)
+	{
+	    if (indp->famc->wife != NULL)
+		ctx->parents.list[ctx->parents.index[i]++] =
+		    indp->famc->wife->id;
+
+	    if (indp->famc->husb != NULL)
+		ctx->parents.list[ctx->parents.index[i]++] =
+		    indp->famc->husb->id;
+	}
+    }
+
+    for (int i = 0; i < ctx->nedges; i++)
+    {
+	edge *edgep = &ctx->edges[i];
+	indi *spouse;
+
+	switch (edgep->type)
+	{
+	case LINK_FAMS:
+	    spouse = partner(individual(ctx, edgep->from),
+			     family(ctx, edgep->to));
+
+	    if (spouse != NULL)
+		ctx->spouses.list[ctx->spouses.index[edgep->from]++] =
+		    spouse->id;
+
+	    ctx->families.list[ctx->families.index[edgep->from]++] =
+		edgep->to;
+	    break;
+
+	case LINK_CHIL:
+	    ctx->children.list[ctx->children.index[edgep->from]++] =
+		edgep->to;
+	    break;
+	}
+    }
+
+    end_csr(&ctx->parents, ninds);
+    end_csr(&ctx->spouses, ninds);
+    end_csr(&ctx->families, ninds);
+    end_csr(&ctx->children, nfams);
+
+    // The links aren't needed any more
+
+    free(ctx->edges);
+    ctx->edges = NULL;
+    ctx->nedges = 0;
+    ctx->maxedges = 0;
+
+    return GPDF_SUCCESS;
+}
+
+int object(gpdf_context *ctx, view first, view second)
+{
+    // Head
+
+    if (find_tag(first) == TAG_HEAD)
+    {
+	ctx->state = STATE_HEAD;
+	return GPDF_SUCCESS;
+    }
+
+    switch (find_tag(second))
+    {
+	// Individual
+
+    case TAG_INDI:
+	{
+	    int id = 0;
+	    view xref = get_xref(first);
+
+	    id = find_individual(ctx, xref);
+
+	    if (id == 0)
+	    {
+		fprintf(stderr, "%s: Can't find slot for '%.*s'\n", progname,
+			first.n, first.p);
+		return GPDF_ERROR;
+	    }
+
+	    ctx->indp = individual(ctx, id);
+	    ctx->indt = individual_text(ctx, id);
+	    ctx->indp->defn = true;
+	    ctx->state = STATE_INDI;
+	}
+	break;
+
+	// Family
+
+    case TAG_FAM:
+	{
+	    int id = 0;
+	    view xref = get_xref(first);
+
+	    id = find_family(ctx, xref);
+
+	    if (id == 0)
+	    {
+		fprintf(stderr, "%s: Can't find slot for '%.*s'\n", progname,
+			first.n, first.p);
+		return GPDF_ERROR;
+	    }
+
+	    ctx->famp = family(ctx, id);
+	    ctx->famt = family_text(ctx, id);
+	    ctx->famp->defn = true;
+	    ctx->state = STATE_FAML;
+	}
+	break;
+
+    default:
+	ctx->state = STATE_NONE;
+    }
+
+    return GPDF_SUCCESS;
+}
+
+int property(gpdf_context *ctx, view first, view second)
+{
+    switch (ctx->state)
+    {
+	// Head
+
+    case STATE_HEAD:
+	if (find_tag(first) == TAG_FILE)
+	{
+	    copy_token(ctx->file, second, sizeof(ctx->file));
+	}
+	break;
+
+	// Individual
+
+    case STATE_INDI:
+	switch (find_tag(first))
+	{
+	case TAG_NAME:
+	    return intern_string(ctx, &ctx->indt->name, second);
+
+	case TAG_SEX:
+	    ctx->indp->sex = (second.n > 0)? second.p[0]: '\0';
+	    break;
+
+	case TAG_BIRT:
+	    ctx->date = DATE_BIRT;
+	    ctx->plac = PLAC_BIRT;
+	    break;
+
+	case TAG_DEAT:
+	    ctx->indt->deat.yes = true;
+	    ctx->date = DATE_DEAT;
+	    ctx->plac = PLAC_DEAT;
+	    break;
+
+	case TAG_FAMC:
+	    {
+		int id = 0;
+		view xref = get_xref(second);
+
+		id = find_family(ctx, xref);
+
+		if (id == 0)
+		{
+		    fprintf(stderr, "%s: Can't find slot for '%.*s'\n",
+			    progname, second.n, second.p);
+		    return GPDF_ERROR;
+		}
+
+		ctx->indp->famc = family(ctx, id);
+	    }
+	    break;
+
+	case TAG_FAMS:
+	    {
+		int id = 0;
+		view xref = get_xref(second);
+
+		id = find_family(ctx, xref);
+
+		if (id == 0)
+		{
+		    fprintf(stderr, "%s: Can't find slot for '%.*s'\n",
+			    progname, second.n, second.p);
+		    return GPDF_ERROR;
+		}
+
+		if (add_edge(ctx, LINK_FAMS, ctx->indp->id, id) !=
+		    GPDF_SUCCESS)
+		    return GPDF_ERROR;
+	    }
+	    break;
+
+	case TAG_NCHI:
+	    {
+		char nchi[SIZE_DATE];
+
+		copy_token(nchi, second, sizeof(nchi));
+		ctx->indp->nchi = atoi(nchi);
+	    }
+	    break;
+
+	case TAG_OCCU:
+	    return intern_string(ctx, &ctx->indt->occu, second);
+
+	default:
+	    ctx->date = DATE_NONE;
+	    ctx->plac = PLAC_NONE;
+	}
+	break;
+
+	// Family
+
+    case STATE_FAML:
+	switch (find_tag(first))
+	{
+	case TAG_HUSB:
+	    {
+		int id = 0;
+		view xref = get_xref(second);
+
+		id = find_individual(ctx, xref);
+
+		if (id == 0)
+		{
+		    fprintf(stderr, "%s: Can't find slot for '%.*s'\n",
+			    progname, second.n, second.p);
+		    return GPDF_ERROR;
+		}
+
+		ctx->famp->husb = individual(ctx, id);
+	    }
+	    break;
+
+	case TAG_WIFE:
+	    {
+		int id = 0;
+		view xref = get_xref(second);
+
+		id = find_individual(ctx, xref);
+
+		if (id == 0)
+		{
+		    fprintf(stderr, "%s: Can't find slot for '%.*s'\n",
+			    progname, second.n, second.p);
+		    return GPDF_ERROR;
+		}
+
+		ctx->famp->wife = individual(ctx, id);
+	    }
+	    break;
+
+	case TAG_CHIL:
+	    {
+		int id = 0;
+		view xref = get_xref(second);
+
+		id = find_individual(ctx, xref);
+
+		if (id == 0)
+		{
+		    fprintf(stderr, "%s: Can't find slot for '%.*s'\n",
+			    progname, second.n, second.p);
+		    return GPDF_ERROR;
+		}
+
+		if (add_edge(ctx, LINK_CHIL, ctx->famp->id, id) !=
+		    GPDF_SUCCESS)
+		    return GPDF_ERROR;
+	    }
+	    break;
+
+	case TAG_MARR:
+	    ctx->famt->marr.yes = true;
+	    ctx->date = DATE_MARR;
+	    ctx->plac = PLAC_MARR;
+	    break;
+
+	case TAG_DIV:
+	    ctx->famt->divc.yes = true;
+	    ctx->date = DATE_DIVC;
+	    ctx->plac = PLAC_DIVC;
+	    break;
+
+	default:
+	    ctx->date = DATE_NONE;
+	    ctx->plac = PLAC_NONE;
+	}
+	break;
+    }
+
+    return GPDF_SUCCESS;
+}
+
+int attrib(gpdf_context *ctx, view first, view second)
+{
+    switch (ctx->state)
+    {
+	// Individual
+
+    case STATE_INDI:
+	switch (find_tag(first))
+	{
+	case TAG_GIVN:
+	    return intern_string(ctx, &ctx->indt->givn, second);
+
+	case TAG_SURN:
+	    return intern_string(ctx, &ctx->indt->surn, second);
+
+	case TAG_NICK:
+	    return intern_string(ctx, &ctx->indt->nick, second);
+
+	case TAG_MARNM:
+	    return intern_string(ctx, &ctx->indt->marn, second);
+
+	case TAG_DATE:
+	    switch (ctx->date)
+	    {
+	    case DATE_BIRT:
+		return intern_string(ctx, &ctx->indt->birt.date, second);
+
+	    case DATE_DEAT:
+		return intern_string(ctx, &ctx->indt->deat.date, second);
+	    }
+	    break;
+
+	case TAG_PLAC:
+	    switch (ctx->plac)
+	    {
+	    case PLAC_BIRT:
+		return intern_string(ctx, &ctx->indt->birt.plac, second);
+
+	    case PLAC_DEAT:
+		return intern_string(ctx, &ctx->indt->deat.plac, second);
+	    }
+	    break;
+	}
+	break;
+
+	// Family
+
+    case STATE_FAML:
+	switch (find_tag(first))
+	{
+	case TAG_DATE:
+	    switch (ctx->date)
+	    {
+	    case DATE_MARR:
+		return intern_string(ctx, &ctx->famt->marr.date, second);
+
+	    case DATE_DIVC:
+		return intern_string(ctx, &ctx->famt->divc.date, second);
+	    }
+	    break;
+
+	case TAG_PLAC:
+	    switch (ctx->plac)
+	    {
+	    case PLAC_MARR:
+		return intern_string(ctx, &ctx->famt->marr.plac, second);
+
+	    case PLAC_DIVC:
+		return intern_string(ctx, &ctx->famt->divc.plac, second);
+	    }
+	    break;
+	}
+	break;
+    }
+
+    return GPDF_SUCCESS;
+}
+
+// Find the generations of descendants of each individual, which is
+// the longest path down to them. Individuals come off a stack once all
+// their children are done, so each parent link is only followed once
+
+int find_generations(gpdf_context *ctx)
+{
+    int *kids = calloc(ctx->indindex, sizeof(int));
+    int *stack = calloc(ctx->indindex, sizeof(int));
+    int done = 0;
+    int top = 0;
+
+    if ((kids == NULL) || (stack == NULL))
+    {
+	free(kids);
+	free(stack);
+	return GPDF_ERROR;
+    }
+
+    // Count the children of each individual
+
+    for (int i = 0; i < ctx->parents.index[ctx->indindex]; i++)
+	kids[ctx->parents.list[i]]++;
+
+    // Start with those without children
+
+    for (int i = 1; i < ctx->indindex; i++)
+	if (kids[i] == 0)
+	    stack[top++] = i;
+
+    // Pass the generations up to the parents
+
+    while (top > 0)
+    {
+	indi *indp = individual(ctx, stack[--top]);
+
+	done++;
+
+	// Remember generations
+
+	if (ctx->gens < indp->gens)
+	    ctx->gens = indp->gens;
+
+	for (int j = ctx->parents.index[indp->id];
+	     j < ctx->parents.index[indp->id + 1]; j++)
+	{
+	    indi *parent = individual(ctx, ctx->parents.list[j]);
+
+	    if (parent->gens < indp->gens + 1)
+		parent->gens = indp->gens + 1;
+
+	    if (--kids[parent->id] == 0)
+		stack[top++] = parent->id;
+	}
+    }
+
+    // Anyone left over is in or above a loop of ancestry
+
+    if (done < ctx->indindex - 1)
+    {
+	for (int i = 1; i < ctx->indindex; i++)
+	{
+	    if (kids[i] > 0)
+	    {
+		fprintf(stderr, "%s: '%s' is their own ancestor, "
+			"%d individuals skipped\n", progname,
+			string(ctx, individual_text(ctx, i)->xref),
+			ctx->indindex - 1 - done);
+		break;
+	    }
+	}
+    }
+
+    free(kids);
+    free(stack);
+
+    // Iterate through the individuals
+
+    for (int i = 1; i < ctx->indindex; i++)
+    {
+	indi *indp = individual(ctx, i);
+
+	if (indp->id > 0)
+    	{
+	    // Check mother and father
+
+	    for (int j = ctx->parents.index[i];
+		 j < ctx->parents.index[i + 1]; j++)
+	    {
+		indi *parent = individual(ctx, ctx->parents.list[j]);
+
+		if (indp->gens < parent->gens - 1)
+		    indp->gens = parent->gens - 1;
+	    }
+
+	    // Calculate x position on page
+
+	    indp->posn.x = indp->gens;
+	}
+    }
+
+    // Iterate through the individuals
+
+    for (int i = 1; i < ctx->indindex; i++)
+    {
+	indi *indp = individual(ctx, i);
+
+	if (indp->id > 0)
+    	{
+	    // See if a wife or husband has more generations
+
+	    for (int j = ctx->spouses.index[i];
+		 j < ctx->spouses.index[i + 1]; j++)
+	    {
+		indi *spouse = individual(ctx, ctx->spouses.list[j]);
+
+		if (spouse->gens > indp->gens)
+		    indp->gens = spouse->gens;
+	    }
+    	}
+    }
+
+    // Iterate through the individuals
+
+    for (int i = 1; i < ctx->indindex; i++)
+    {
+	indi *indp = individual(ctx, i);
+
+	if ((indp->id > 0) && (indp->gens < SIZE_GENS))
+
+	    // Increment generation count
+	    ctx->genc[indp->gens]++;
+    }
+
+    return GPDF_SUCCESS;
+}
+
+// Compare the places of individuals by barycentre, keeping their last
+// order where they are the same
+
+int compare_ranks(const void *a, const void *b)
+{
+    const rank *ra = a;
+    const rank *rb = b;
+
+    if (ra->key != rb->key)
+	return (ra->key < rb->key)? -1: 1;
+
+    if (ra->last != rb->last)
+	return (ra->last < rb->last)? -1: 1;
+
+    return 0;
+}
+
+// Wait for work from the crew, taking pieces of each task until there
+// are none left
+
+void *crew_worker(void *arg)
+{
+    crew *cp = arg;
+    int round = 0;
+
+    pthread_mutex_lock(&cp->mutex);
+
+    for (;;)
+    {
+	while ((cp->round == round) && !cp->quit)
+	    pthread_cond_wait(&cp->start, &cp->mutex);
+
+	if (cp->quit)
+	    break;
+
+	round = cp->round;
+	pthread_mutex_unlock(&cp->mutex);
+
+	cp->task(cp);
+
+	pthread_mutex_lock(&cp->mutex);
+
+	if (--cp->busy == 0)
+	    pthread_cond_signal(&cp->done);
+    }
+
+    pthread_mutex_unlock(&cp->mutex);
+
+    return NULL;
+}
+
+// Start a crew of threads that stay waiting for tasks, so a task for
+// each column doesn't cost a thread each time
+
+int start_crew(crew *cp, int n, void *arg)
+{
+    memset(cp, 0, sizeof(*cp));
+    cp->arg = arg;
+
+    pthread_mutex_init(&cp->mutex, NULL);
+    pthread_cond_init(&cp->start, NULL);
+    pthread_cond_init(&cp->done, NULL);
+
+    for (cp->workers = 0; cp->workers < n - 1; cp->workers++)
+    {
+	if (pthread_create(&cp->tids[cp->workers], NULL,
+			   crew_worker, cp) != 0)
+	    return GPDF_ERROR;
+    }
+
+    return GPDF_SUCCESS;
+}
+
+void stop_crew(crew *cp)
+{
+    pthread_mutex_lock(&cp->mutex);
+    cp->quit = true;
+    pthread_cond_broadcast(&cp->start);
+    pthread_mutex_unlock(&cp->mutex);
+
+    for (int i = 0; i < cp->workers; i++)
+	pthread_join(cp->tids[i], NULL);
+
+    pthread_mutex_destroy(&cp->mutex);
+    pthread_cond_destroy(&cp->start);
+    pthread_cond_destroy(&cp->done);
+}
+
+// Run a task in pieces on the crew and this thread. Each thread takes
+// the next piece as it finishes the last, so the work evens out
+
+void run_crew(crew *cp, void (*task)(crew *), int pieces)
+{
+    cp->task = task;
+    cp->next = 0;
+    cp->pieces = pieces;
+
+    if ((cp->workers == 0) || (pieces < 2))
+    {
+	task(cp);
+	return;
+    }
+
+    pthread_mutex_lock(&cp->mutex);
+    cp->busy = cp->workers;
+    cp->round++;
+    pthread_cond_broadcast(&cp->start);
+    pthread_mutex_unlock(&cp->mutex);
+
+    task(cp);
+
+    pthread_mutex_lock(&cp->mutex);
+
+    while (cp->busy > 0)
+	pthread_cond_wait(&cp->done, &cp->mutex);
+
+    pthread_mutex_unlock(&cp->mutex);
+}
+
+// Take the next piece of a task, or -1 when there are none left
+
+int next_piece(crew *cp)
+{
+    int piece = __sync_fetch_and_add(&cp->next, 1);
+
+    return (piece < cp->pieces)? piece: -1;
+}
+
+// Find the barycentre of each individual in a block of the column, the
+// average place of their parents going down, or of their children and
+// spouses coming up
+
+void key_task(crew *cp)
+{
+    sweep *swp = cp->arg;
+    gpdf_context *ctx = swp->ctx;
+    int piece;
+
+    while ((piece = next_piece(cp)) >= 0)
+    {
+	int first = swp->first + (piece * SIZE_BLOCK);
+	int last = (first + SIZE_BLOCK < swp->first + swp->n)?
+	    first + SIZE_BLOCK: swp->first + swp->n;
+
+	for (int j = first; j < last; j++)
+	{
+	    int id = swp->column.list[j];
+	    float sum = 0;
+	    int count = 0;
+
+	    if (swp->down)
+	    {
+		for (int k = ctx->parents.index[id];
+		     k < ctx->parents.index[id + 1]; k++, count++)
+		    sum += swp->place[ctx->parents.list[k]];
+	    }
+
+	    else
+	    {
+		for (int k = ctx->families.index[id];
+		     k < ctx->families.index[id + 1]; k++)
+		{
+		    int fam = ctx->families.list[k];
+
+		    for (int l = ctx->children.index[fam];
+			 l < ctx->children.index[fam + 1]; l++, count++)
+			sum += swp->place[ctx->children.list[l]];
+		}
+
+		for (int k = ctx->spouses.index[id];
+		     k < ctx->spouses.index[id + 1]; k++, count++)
+		    sum += swp->place[ctx->spouses.list[k]];
+	    }
+
+	    // Those with nobody to follow keep their place
+
+	    swp->ranks[j].key = (count > 0)? sum / count: swp->place[id];
+	    swp->ranks[j].last = swp->place[id];
+	    swp->ranks[j].id = id;
+	}
+    }
+}
+
+// Start of a segment of the column
+
+int segment(sweep *swp, int k)
+{
+    return swp->first + (int)((long long)swp->n * k / swp->segments);
+}
+
+// Sort a segment of the column
+
+void sort_task(crew *cp)
+{
+    sweep *swp = cp->arg;
+    int piece;
+
+    while ((piece = next_piece(cp)) >= 0)
+    {
+	int first = segment(swp, piece);
+
+	qsort(&swp->ranks[first], segment(swp, piece + 1) - first,
+	      sizeof(rank), compare_ranks);
+    }
+}
+
+// Merge the sorted segments in pairs until there is one, swapping the
+// ranks and the spare each pass
+
+void merge_segments(sweep *swp)
+{
+    for (int step = 1; step < swp->segments; step *= 2)
+    {
+	for (int k = 0; k < swp->segments; k += step * 2)
+	{
+	    int i = segment(swp, k);
+	    int mid = segment(swp, (k + step < swp->segments)?
+			      k + step: swp->segments);
+	    int end = segment(swp, (k + (step * 2) < swp->segments)?
+			      k + (step * 2): swp->segments);
+	    int j = mid;
+	    int n = i;
+
+	    while ((i < mid) || (j < end))
+	    {
+		if ((j == end) || ((i < mid) &&
+				   (compare_ranks(&swp->ranks[i],
+						  &swp->ranks[j]) <= 0)))
+		    swp->spare[n++] = swp->ranks[i++];
+
+		else
+		    swp->spare[n++] = swp->ranks[j++];
+	    }
+	}
+
+	rank *ranks = swp->ranks;
+	swp->ranks = swp->spare;
+	swp->spare = ranks;
+    }
+}
+
+// Order one column by barycentre. Big columns are keyed in blocks and
+// sorted in segments across the crew, then the segments are merged
+
+void sweep_column(sweep *swp, int column, bool down)
+{
+    int first = swp->column.index[column];
+    int n = swp->column.index[column + 1] - first;
+
+    swp->first = first;
+    swp->n = n;
+    swp->down = down;
+    swp->segments = (n >= SIZE_BLOCK * threads)? threads: 1;
+
+    run_crew(&swp->crew, key_task, (n + SIZE_BLOCK - 1) / SIZE_BLOCK);
+    run_crew(&swp->crew, sort_task, swp->segments);
+    merge_segments(swp);
+
+    for (int j = first; j < first + n; j++)
+    {
+	swp->column.list[j] = swp->ranks[j].id;
+	swp->place[swp->ranks[j].id] = (j - first + 0.5) / n;
+    }
+}
+
+// Add one to a Fenwick tree entry
+
+void add_fenwick(int *tree, int n, int i)
+{
+    for (i++; i <= n; i += i & -i)
+	tree[i]++;
+}
+
+// Count the entries up to and including i in a Fenwick tree
+
+int sum_fenwick(int *tree, int i)
+{
+    int sum = 0;
+
+    for (i++; i > 0; i -= i & -i)
+	sum += tree[i];
+
+    return sum;
+}
+
+// Compare lines by the slot of the parent, then of the child
+
+int compare_lines(const void *a, const void *b)
+{
+    const int *la = a;
+    const int *lb = b;
+
+    if (la[0] != lb[0])
+	return (la[0] < lb[0])? -1: 1;
+
+    return (la[1] > lb[1]) - (la[1] < lb[1]);
+}
+
+// Count how many lines from parents in the next column to their
+// children cross. Sorted by parent, a line crosses each line already
+// seen that ends further down, which a Fenwick tree over the child
+// slots counts in O(E log V)
+
+long long count_crossings(gpdf_context *ctx, csr *column, int columns)
+{
+    int *slot = calloc(ctx->indindex, sizeof(int));
+    int *lines = malloc((ctx->parents.index[ctx->indindex] + 1) *
+			2 * sizeof(int));
+    int *tree = NULL;
+    long long crossings = 0;
+
+    if ((slot == NULL) || (lines == NULL))
+    {
+	free(slot);
+	free(lines);
+	return -1;
+    }
+
+    for (int c = 0; c < columns; c++)
+	for (int j = column->index[c]; j < column->index[c + 1]; j++)
+	    slot[column->list[j]] = j - column->index[c];
+
+    for (int c = 0; c < columns - 1; c++)
+    {
+	int n = column->index[c + 1] - column->index[c];
+	int count = 0;
+
+	// Lines from this column to parents in the next
+
+	for (int j = column->index[c]; j < column->index[c + 1]; j++)
+	{
+	    int id = column->list[j];
+
+	    for (int k = ctx->parents.index[id];
+		 k < ctx->parents.index[id + 1]; k++)
+	    {
+		int parent = ctx->parents.list[k];
+
+		if ((individual(ctx, parent)->gens == c + 1) &&
+		    (individual(ctx, id)->gens == c))
+		{
+		    lines[count * 2] = slot[parent];
+		    lines[(count * 2) + 1] = slot[id];
+		    count++;
+		}
+	    }
+	}
+
+	qsort(lines, count, 2 * sizeof(int), compare_lines);
+
+	free(tree);
+	tree = calloc(n + 1, sizeof(int));
+
+	if (tree == NULL)
+	{
+	    crossings = -1;
+	    break;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+	    crossings += i - sum_fenwick(tree, lines[(i * 2) + 1]);
+	    add_fenwick(tree, n, lines[(i * 2) + 1]);
+	}
+    }
+
+    free(tree);
+    free(slot);
+    free(lines);
+
+    return crossings;
+}
+
+// Lay out the individuals in columns by generation, ordering each
+// column to keep families together and lines from crossing. Each sweep
+// orders the columns from the oldest down by parents, then back up by
+// children, sorting each column once, so it's O(n log n) a sweep
+
+int layout_individuals(gpdf_context *ctx)
+{
+    sweep sw = {.ctx = ctx};
+    bool crewed = false;
+    int columns = 1;
+    int status = GPDF_SUCCESS;
+
+    // Anyone above a loop of ancestry may be past the last generation
+
+    for (int i = 1; i < ctx->indindex; i++)
+	if (columns < individual(ctx, i)->gens + 1)
+	    columns = individual(ctx, i)->gens + 1;
+
+    sw.place = calloc(ctx->indindex, sizeof(float));
+    sw.ranks = calloc(ctx->indindex, sizeof(rank));
+    sw.spare = calloc(ctx->indindex, sizeof(rank));
+
+    if ((sw.place == NULL) || (sw.ranks == NULL) || (sw.spare == NULL) ||
+	(start_csr(&sw.column, columns) != GPDF_SUCCESS))
+	status = GPDF_ERROR;
+
+    // Put the individuals in their columns in file order
+
+    if (status == GPDF_SUCCESS)
+    {
+	for (int i = 1; i < ctx->indindex; i++)
+	    if (individual(ctx, i)->id > 0)
+		sw.column.index[individual(ctx, i)->gens + 1]++;
+
+	status = fill_csr(&sw.column, columns);
+    }
+
+    if (status == GPDF_SUCCESS)
+    {
+	for (int i = 1; i < ctx->indindex; i++)
+	    if (individual(ctx, i)->id > 0)
+		sw.column.list[sw.column.index[individual(ctx, i)->gens]++] =
+		    i;
+
+	end_csr(&sw.column, columns);
+
+	for (int c = 0; c < columns; c++)
+	{
+	    int n = sw.column.index[c + 1] - sw.column.index[c];
+
+	    for (int j = sw.column.index[c]; j < sw.column.index[c + 1]; j++)
+		sw.place[sw.column.list[j]] = (j - sw.column.index[c] + 0.5) / n;
+	}
+
+	if (showstats)
+	    ctx->crossings[0] = count_crossings(ctx, &sw.column, columns);
+
+	status = start_crew(&sw.crew, threads, &sw);
+	crewed = true;
+    }
+
+    // Sweep down from the oldest generation and back up
+
+    if (status == GPDF_SUCCESS)
+    {
+	for (int i = 0; i < SIZE_SWEEPS; i++)
+	{
+	    for (int c = columns - 2; c >= 0; c--)
+		sweep_column(&sw, c, true);
+
+	    for (int c = 1; c < columns; c++)
+		sweep_column(&sw, c, false);
+	}
+
+	if (showstats)
+	    ctx->crossings[1] = count_crossings(ctx, &sw.column, columns);
+
+	// Give each individual a slot down their column
+
+	ctx->slotmax = 0;
+
+	for (int c = 0; c < columns; c++)
+	{
+	    int n = sw.column.index[c + 1] - sw.column.index[c];
+
+	    for (int j = sw.column.index[c]; j < sw.column.index[c + 1]; j++)
+	    {
+		indi *indp = individual(ctx, sw.column.list[j]);
+
+		indp->posn.x = indp->gens;
+		indp->posn.y = j - sw.column.index[c] + 1;
+	    }
+
+	    if (ctx->slotmax < n)
+		ctx->slotmax = n;
+	}
+    }
+
+    if (crewed)
+	stop_crew(&sw.crew);
+
+    free(sw.place);
+    free(sw.ranks);
+    free(sw.spare);
+    free_csr(&sw.column);
+
+    return status;
+}
+
+// Mark the relatives of an individual still to be placed, so they are
+// placed again around them
+
+void mark_relatives(gpdf_context *ctx, char *mark, int id)
+{
+    for (int k = ctx->parents.index[id];
+	 k < ctx->parents.index[id + 1]; k++)
+	if (mark[ctx->parents.list[k]] == MARK_FIXED)
+	    mark[ctx->parents.list[k]] = MARK_AFFECTED;
+
+    for (int k = ctx->families.index[id];
+	 k < ctx->families.index[id + 1]; k++)
+    {
+	int fam = ctx->families.list[k];
+
+	for (int l = ctx->children.index[fam];
+	     l < ctx->children.index[fam + 1]; l++)
+	    if (mark[ctx->children.list[l]] == MARK_FIXED)
+		mark[ctx->children.list[l]] = MARK_AFFECTED;
+    }
+
+    for (int k = ctx->spouses.index[id];
+	 k < ctx->spouses.index[id + 1]; k++)
+	if (mark[ctx->spouses.list[k]] == MARK_FIXED)
+	    mark[ctx->spouses.list[k]] = MARK_AFFECTED;
+}
+
+// Average slot of the relatives of an individual that have one, or
+// zero if none do
+
+float relative_slot(gpdf_context *ctx, char *mark, int id)
+{
+    float sum = 0;
+    int count = 0;
+
+    for (int k = ctx->parents.index[id];
+	 k < ctx->parents.index[id + 1]; k++)
+    {
+	int parent = ctx->parents.list[k];
+
+	if ((mark[parent] == MARK_FIXED) || (mark[parent] == MARK_PLACED))
+	{
+	    sum += individual(ctx, parent)->posn.y;
+	    count++;
+	}
+    }
+
+    for (int k = ctx->families.index[id];
+	 k < ctx->families.index[id + 1]; k++)
+    {
+	int fam = ctx->families.list[k];
+
+	for (int l = ctx->children.index[fam];
+	     l < ctx->children.index[fam + 1]; l++)
+	{
+	    int child = ctx->children.list[l];
+
+	    if ((mark[child] == MARK_FIXED) ||
+		(mark[child] == MARK_PLACED))
+	    {
+		sum += individual(ctx, child)->posn.y;
+		count++;
+	    }
+	}
+    }
+
+    for (int k = ctx->spouses.index[id];
+	 k < ctx->spouses.index[id + 1]; k++)
+    {
+	int spouse = ctx->spouses.list[k];
+
+	if ((mark[spouse] == MARK_FIXED) || (mark[spouse] == MARK_PLACED))
+	{
+	    sum += individual(ctx, spouse)->posn.y;
+	    count++;
+	}
+    }
+
+    return (count > 0)? sum / count: 0;
+}
+
+// First entry in a sorted list not less than a value
+
+int lower_bound(int *list, int n, int value)
+{
+    int lo = 0;
+    int hi = n;
+
+    while (lo < hi)
+    {
+	int mid = (lo + hi) / 2;
+
+	if (list[mid] < value)
+	    lo = mid + 1;
+
+	else
+	    hi = mid;
+    }
+
+    return lo;
+}
+
+// Find the whole slot nearest a place that is at least one slot from
+// those taken, which are kept in half slots so hand placed individuals
+// half way between slots keep their room
+
+int free_slot(int *taken, int n, float place)
+{
+    int first = (place > 1)? (int)lroundf(place): 1;
+
+    for (int d = 0;; d++)
+    {
+	for (int s = 0; s < 2; s++)
+	{
+	    int slot = s? first - d: first + d;
+	    int i;
+
+	    if ((slot < 1) || ((s == 1) && (d == 0)))
+		continue;
+
+	    i = lower_bound(taken, n, (slot * 2) - 1);
+
+	    if ((i == n) || (taken[i] > (slot * 2) + 1))
+		return slot;
+	}
+    }
+}
+
+// Place the individuals that are new or have changed generation since
+// the text file read, and their relatives, leaving everyone else where
+// they were. Going from the oldest column down, each goes in the free
+// slot in their column nearest the average slot of their relatives
+
+int relayout_individuals(gpdf_context *ctx)
+{
+    char *mark = calloc(ctx->indindex, sizeof(char));
+    int *fixed = malloc(ctx->indindex * 2 * sizeof(int));
+    int *affected = malloc(ctx->indindex * 2 * sizeof(int));
+    int *taken = malloc(ctx->indindex * sizeof(int));
+    int nfixed = 0;
+    int naffected = 0;
+    float slots = 0;
+
+    if ((mark == NULL) || (fixed == NULL) || (affected == NULL) ||
+	(taken == NULL))
+    {
+	free(mark);
+	free(fixed);
+	free(affected);
+	free(taken);
+	return GPDF_ERROR;
+    }
+
+    // Those read keep their place, others go in their generation
+
+    ctx->added = 0;
+
+    for (int i = 1; i < ctx->indindex; i++)
+    {
+	indi *indp = individual(ctx, i);
+
+	if (indp->id <= 0)
+	    continue;
+
+	if (indp->place == PLACE_READ)
+	    mark[i] = MARK_FIXED;
+
+	else
+	{
+	    mark[i] = MARK_AFFECTED;
+	    indp->posn.x = indp->gens;
+
+	    if (indp->place == PLACE_NONE)
+		ctx->added++;
+	}
+    }
+
+    for (int i = 1; i < ctx->indindex; i++)
+	if ((individual(ctx, i)->id > 0) &&
+	    (individual(ctx, i)->place != PLACE_READ))
+	    mark_relatives(ctx, mark, i);
+
+    // Sort the fixed by column from the oldest, then by half slot, and
+    // those to place by column, then by id
+
+    for (int i = 1; i < ctx->indindex; i++)
+    {
+	indi *indp = individual(ctx, i);
+
+	if (mark[i] == MARK_FIXED)
+	{
+	    fixed[nfixed * 2] = -lroundf(indp->posn.x);
+	    fixed[(nfixed * 2) + 1] = lroundf(indp->posn.y * 2);
+	    nfixed++;
+
+	    if (slots < indp->posn.y)
+		slots = indp->posn.y;
+	}
+
+	else if (mark[i] == MARK_AFFECTED)
+	{
+	    affected[naffected * 2] = -lroundf(indp->posn.x);
+	    affected[(naffected * 2) + 1] = i;
+	    naffected++;
+	}
+    }
+
+    qsort(fixed, nfixed, 2 * sizeof(int), compare_lines);
+    qsort(affected, naffected, 2 * sizeof(int), compare_lines);
+
+    // Place each column, starting with the slots taken in it
+
+    for (int i = 0, f = 0; i < naffected;)
+    {
+	int column = -affected[i * 2];
+	int n = 0;
+
+	while ((f < nfixed) && (-fixed[f * 2] > column))
+	    f++;
+
+	for (; (f < nfixed) && (-fixed[f * 2] == column); f++)
+	    taken[n++] = fixed[(f * 2) + 1];
+
+	for (; (i < naffected) && (-affected[i * 2] == column); i++)
+	{
+	    int id = affected[(i * 2) + 1];
+	    indi *indp = individual(ctx, id);
+	    float place = relative_slot(ctx, mark, id);
+	    int slot;
+	    int k;
+
+	    // Those with nobody placed go after the rest
+
+	    if (place == 0)
+		place = (n > 0)? (taken[n - 1] / 2) + 1: 1;
+
+	    slot = free_slot(taken, n, place);
+	    k = lower_bound(taken, n, slot * 2);
+
+	    memmove(&taken[k + 1], &taken[k], (n - k) * sizeof(int));
+	    taken[k] = slot * 2;
+	    n++;
+
+	    indp->posn.x = column;
+	    indp->posn.y = slot;
+	    mark[id] = MARK_PLACED;
+
+	    if (slots < slot)
+		slots = slot;
+	}
+    }
+
+    ctx->placed = naffected;
+    ctx->slotmax = slots;
+
+    free(mark);
+    free(fixed);
+    free(affected);
+    free(taken);
+
+    return GPDF_SUCCESS;
+}
+
+// Create a file, but don't overwrite one that's there
+
+FILE *create_file(char *filename)
+{
+    FILE *file;
+
+#ifndef __MINGW32__
+    file = fopen(filename, "wx");
+#else
+    // File open mode 'wx' not supported by windows, although in POSIX
+    // accorrding to Gnu C Library docs.
+
+    file = fopen(filename, "r");
+
+    if (file != NULL)
+    {
+	fclose(file);
+	fprintf(stderr, "%s: Not overwriting '%s'\n", progname, filename);
+	return NULL;
+    }
+
+    file = fopen(filename, "wb");
+#endif
+    if (file == NULL)
+	fprintf(stderr, "%s: cant't write to %s\n", progname, filename);
+
+    return file;
+}
+
+int write_textfile(gpdf_context *ctx)
+{
+    char filename[SIZE_LINE];
+    FILE *textfile;
+
+    strcpy(filename, ctx->file);
+    strcat(filename, ".txt");
+
+    textfile = create_file(filename);
+
+    if (textfile == NULL)
+	return GPDF_SUCCESS;
+
+    fprintf(textfile, "   0        posn  suggested\n");
+    fprintf(textfile, "   0  xref  x  y      x      Name\n");
+
+    for (int i = 1; i < ctx->indindex; i++)
+    {
+	indi *indp = individual(ctx, i);
+	itext *textp = individual_text(ctx, i);
+
+	if (indp->id > 0)
+	{
+	    fprintf(textfile, "%4d  %-4s %2.0f %4.1f   %2d      %s\n",
+		    indp->id, string(ctx, textp->xref), indp->posn.x,
+		    indp->posn.y, indp->gens, string(ctx, textp->name));
+	}
+    }
+
+    fclose(textfile);
+
+    return GPDF_SUCCESS;
+}
+
+// Write the positions in binary, a header then a record for each
+// individual of the xref length, the xref, x, y and the generation.
+// Read_textfile reads either kind
+
+int write_posnfile(gpdf_context *ctx)
+{
+    char filename[SIZE_LINE];
+    posnhead head = {POSN_MAGIC, 0};
+    FILE *posnfile;
+
+    strcpy(filename, ctx->file);
+    strcat(filename, ".pos");
+
+    posnfile = create_file(filename);
+
+    if (posnfile == NULL)
+	return GPDF_SUCCESS;
+
+    for (int i = 1; i < ctx->indindex; i++)
+	if (individual(ctx, i)->id > 0)
+	    head.count++;
+
+    fwrite(&head, sizeof(head), 1, posnfile);
+
+    for (int i = 1; i < ctx->indindex; i++)
+    {
+	indi *indp = individual(ctx, i);
+	char *xref = string(ctx, individual_text(ctx, i)->xref);
+	unsigned char length = strnlen(xref, SIZE_XREF - 1);
+	posnrec rec = {indp->posn.x, indp->posn.y, indp->gens};
+
+	if (indp->id > 0)
+	{
+	    fputc(length, posnfile);
+	    fwrite(xref, length, 1, posnfile);
+	    fwrite(&rec, sizeof(rec), 1, posnfile);
+	}
+    }
+
+    if (fclose(posnfile) != 0)
+    {
+	fprintf(stderr, "%s: can't write to %s\n", progname, filename);
+	return GPDF_ERROR;
+    }
+
+    return GPDF_SUCCESS;
+}
+
+// Set the position of an individual read from a text file, noting the
+// xrefs that aren't in the tree
+
+void read_position(gpdf_context *ctx, view xref, float x, float y, int gens)
+{
+    // Don't add individuals once the graph is built
+
+    int id = lookup_individual(ctx, xref, hash_xref(xref), &ctx->probes);
+
+    if (id > 0)
+    {
+	indi *indp = individual(ctx, id);
+
+	indp->posn.x = x;
+	indp->posn.y = y;
+
+	// Note those whose generation has changed since
+
+	if ((gens >= 0) && (gens != indp->gens))
+	{
+	    indp->place = PLACE_MOVED;
+	    ctx->moved++;
+	}
+
+	else
+	{
+	    indp->place = PLACE_READ;
+	    ctx->kept++;
+	}
+
+	if (ctx->slotmax < y)
+	    ctx->slotmax = y;
+    }
+
+    else
+    {
+	if (ctx->removed < SIZE_UNKNOWN)
+	    snprintf(ctx->unknown[ctx->removed], SIZE_XREF, "%.*s",
+		     xref.n, xref.p);
+
+	ctx->removed++;
+    }
+}
+
+// Read binary positions from after the header
+
+int read_posnfile(gpdf_context *ctx, FILE *posnfile, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+	char xref[SIZE_XREF];
+	int length = fgetc(posnfile);
+	posnrec rec;
+
+	if ((length == EOF) || (length >= SIZE_XREF) ||
+	    (fread(xref, length, 1, posnfile) != 1) ||
+	    (fread(&rec, sizeof(rec), 1, posnfile) != 1))
+	    return GPDF_ERROR;
+
+	read_position(ctx, (view){xref, length}, rec.x, rec.y, rec.gens);
+    }
+
+    return GPDF_SUCCESS;
+}
+
+// Read the positions from the text file, or the binary file written
+// by -x
+
+int read_textfile(gpdf_context *ctx)
+{
+    char filename[SIZE_LINE];
+    char *line = NULL;
+    size_t size = 0;
+    posnhead head;
+    FILE *textfile;
+    int status = GPDF_SUCCESS;
+
+    if (readtext)
+	strcpy(filename, text);
+
+    else
+    {
+	strcpy(filename, ctx->file);
+	strcat(filename, ".txt");
+    }
+
+    textfile = fopen(filename, "rb");
+
+    if (textfile == NULL)
+    {
+	fprintf(stderr, "%s: can't read '%s'\n", progname, filename);
+	return GPDF_ERROR;
+    }
+
+    ctx->slotmax = 0;
+
+    if ((fread(&head, sizeof(head), 1, textfile) == 1) &&
+	(memcmp(head.magic, POSN_MAGIC, sizeof(head.magic)) == 0))
+	status = read_posnfile(ctx, textfile, head.count);
+
+    else
+    {
+	rewind(textfile);
+
+	while (getline(&line, &size, textfile) != -1)
+	{
+	    int id = 0;
+	    char xref[SIZE_XREF];
+	    float x = 0;
+	    float y = 0;
+	    int gens = -1;
+
+	    // Parse first five fields, ignore the rest
+
+	    sscanf(line, " %d %31s %f %f %d", &id, xref, &x, &y, &gens);
+
+	    if (id > 0)
+		read_position(ctx, (view){xref, strlen(xref)}, x, y, gens);
+	}
+
+	free(line);
+    }
+
+    fclose(textfile);
+
+    if (status != GPDF_SUCCESS)
+    {
+	fprintf(stderr, "%s: '%s' is truncated\n", progname, filename);
+	return GPDF_ERROR;
+    }
+
+    // List the first few xrefs not found
+
+    if (ctx->removed > 0)
+    {
+	fprintf(stderr, "%s: %d xrefs in '%s' not found:", progname,
+		ctx->removed, filename);
+
+	for (int i = 0; (i < ctx->removed) && (i < SIZE_UNKNOWN); i++)
+	    fprintf(stderr, " %s", ctx->unknown[i]);
+
+	fprintf(stderr, (ctx->removed > SIZE_UNKNOWN)? " ...\n": "\n");
+    }
+
+    ctx->positioned = true;
+
+    return GPDF_SUCCESS;
+}
+
+// Allocate memory for libharu from the document heap. Most requests
+// are for blocks of libharu's own pool, too big ones get a block of
+// their own behind the current one, so its space isn't wasted
+
+void *HPDF_STDCALL heap_alloc(HPDF_UINT size)
+{
+    size_t need = (size + SIZE_ALIGN - 1) & ~(size_t)(SIZE_ALIGN - 1);
+    heap *hp = &docheap;
+
+    hp->allocs++;
+
+    if ((hp->block == NULL) || (hp->used + need > hp->size))
+    {
+	size_t size = (need > SIZE_HEAP / 4)? need + SIZE_ALIGN: SIZE_HEAP;
+	char *block = malloc(size);
+
+	if (block == NULL)
+	    return NULL;
+
+	hp->blocks++;
+	hp->bytes += size;
+
+	if ((need > SIZE_HEAP / 4) && (hp->block != NULL))
+	{
+	    *(char **)block = *(char **)hp->block;
+	    *(char **)hp->block = block;
+
+	    return block + SIZE_ALIGN;
+	}
+
+	*(char **)block = hp->block;
+	hp->block = block;
+	hp->size = size;
+	hp->used = SIZE_ALIGN;
+    }
+
+    hp->used += need;
+
+    return hp->block + hp->used - need;
+}
+
+// Nothing is freed until the document is done with
+
+void HPDF_STDCALL heap_free(void *aptr)
+{
+    (void)aptr;
+    docheap.frees++;
+}
+
+// Free the document, then all of its memory at once
+
+void free_document(HPDF_Doc pdf)
+{
+    HPDF_Free(pdf);
+
+    while (docheap.block != NULL)
+    {
+	char *block = docheap.block;
+
+	docheap.block = *(char **)block;
+	free(block);
+    }
+
+    docheap.size = docheap.used = 0;
+}
+
+// Error handler from examples
+
+void error_handler(HPDF_STATUS error_no, HPDF_STATUS   detail_no,
+		   void *user_data)
+{
+    gpdf_context *ctx = user_data;
+
+    fprintf (stderr, "%s: libHaru error_no = %04X, detail_no = %u\n",
+	     progname, (HPDF_UINT)error_no, (HPDF_UINT)detail_no);
+
+    longjmp(ctx->env, 1);
+}
+
+// Add the text in the scratch pool to the string pool as a run, empty
+// runs are left out
+
+int end_run(gpdf_context *ctx, int font, int line)
+{
+    view text = {ctx->scratch.data, ctx->scratch.used};
+    run *runp;
+
+    ctx->scratch.used = 0;
+
+    if (text.n == 0)
+	return GPDF_SUCCESS;
+
+    if (ctx->nruns == ctx->maxruns)
+    {
+	int size = (ctx->maxruns == 0)? SIZE_RUNS: ctx->maxruns * 2;
+	run *runs = realloc(ctx->runs, size * sizeof(run));
+
+	if (runs == NULL)
+	    return GPDF_ERROR;
+
+	ctx->runs = runs;
+	ctx->maxruns = size;
+    }
+
+    runp = &ctx->runs[ctx->nruns];
+    runp->font = font;
+    runp->line = line;
+
+    if (intern_string(ctx, &runp->text, text) != GPDF_SUCCESS)
+	return GPDF_ERROR;
+
+    ctx->nruns++;
+
+    return GPDF_SUCCESS;
+}
+
+// Add some text to the scratch pool
+
+int add_scratch(gpdf_context *ctx, char *text, int n)
+{
+    if (grow_pool(&ctx->scratch, n) != GPDF_SUCCESS)
+	return GPDF_ERROR;
+
+    memcpy(ctx->scratch.data + ctx->scratch.used, text, n);
+    ctx->scratch.used += n;
+
+    return GPDF_SUCCESS;
+}
+
+// Add a run of part of a string. The text is copied out before the
+// pool can grow, so it may come from the pool
+
+int add_run(gpdf_context *ctx, int font, int line, view text)
+{
+    if (add_scratch(ctx, text.p, text.n) != GPDF_SUCCESS)
+	return GPDF_ERROR;
+
+    return end_run(ctx, font, line);
+}
+
+// Add a run made of strings up to a NULL
+
+int add_text(gpdf_context *ctx, int font, int line, ...)
+{
+    va_list args;
+    char *text;
+
+    va_start(args, line);
+
+    while ((text = va_arg(args, char *)) != NULL)
+    {
+	if (add_scratch(ctx, text, strlen(text)) != GPDF_SUCCESS)
+	{
+	    va_end(args);
+	    return GPDF_ERROR;
+	}
+    }
+
+    va_end(args);
+
+    return end_run(ctx, font, line);
+}
+
+// Add a line for an event with a date, a place or both
+
+int add_event(gpdf_context *ctx, int *line, char *label, int date, int plac)
+{
+    char *datep = string(ctx, date);
+    char *placp = string(ctx, plac);
+
+    if ((datep[0] == '\0') && (placp[0] == '\0'))
+	return GPDF_SUCCESS;
+
+    return add_text(ctx, RUN_NORMAL, ++(*line), label, datep,
+		    ((datep[0] != '\0') && (placp[0] != '\0'))? " ": "",
+		    placp, NULL);
+}
+
+// Build the runs of text for one individual
+
+int render_individual(gpdf_context *ctx, int id)
+{
+    indi *indp = individual(ctx, id);
+    itext *textp = individual_text(ctx, id);
+    int line = 0;
+
+    // Name, given names up to the first '/', surname up to the next
+
+    if (string(ctx, textp->givn)[0] == '\0')
+    {
+	char *name = string(ctx, textp->name);
+	char *surn = strchr(name, '/');
+
+	if (surn == NULL)
+	    return add_text(ctx, RUN_NORMAL, line, name, NULL);
+
+	int n = surn - name;
+	char *endn = strchr(surn + 1, '/');
+	view givn = {name, n};
+	view last = {surn + 1, (endn == NULL)? (int)strlen(surn + 1):
+		     endn - (surn + 1)};
+
+	if (add_run(ctx, RUN_NORMAL, line, givn) != GPDF_SUCCESS)
+	    return GPDF_ERROR;
+
+	// The pool may have moved
+
+	last.p = string(ctx, textp->name) + n + 1;
+
+	if (add_run(ctx, RUN_BOLD, line, last) != GPDF_SUCCESS)
+	    return GPDF_ERROR;
+    }
+
+    else
+    {
+	// Given names 'nickname' surname
+
+	char *nick = string(ctx, textp->nick);
+
+	if ((add_text(ctx, RUN_NORMAL, line, string(ctx, textp->givn),
+		      (nick[0] != '\0')? " '": " ", nick,
+		      (nick[0] != '\0')? "' ": "", NULL) != GPDF_SUCCESS) ||
+	    (add_text(ctx, RUN_BOLD, line, string(ctx, textp->surn),
+		      NULL) != GPDF_SUCCESS))
+	    return GPDF_ERROR;
+    }
+
+    // Birth
+
+    if (add_event(ctx, &line, "b   ", textp->birt.date,
+		  textp->birt.plac) != GPDF_SUCCESS)
+	return GPDF_ERROR;
+
+    // Occupation
+
+    if ((string(ctx, textp->occu)[0] != '\0') &&
+	(add_text(ctx, RUN_NORMAL, ++line, "o   ", string(ctx, textp->occu),
+		  NULL) != GPDF_SUCCESS))
+	return GPDF_ERROR;
+
+    // Marriages and divorces
+
+    if (indp->sex == 'F')
+    {
+	for (int j = ctx->families.index[id];
+	     j < ctx->families.index[id + 1]; j++)
+	{
+	    ftext *famt = family_text(ctx, ctx->families.list[j]);
+	    bool married = (string(ctx, famt->marr.date)[0] != '\0') ||
+		(string(ctx, famt->marr.plac)[0] != '\0');
+
+	    if ((add_event(ctx, &line, "m  ", famt->marr.date,
+			   famt->marr.plac) != GPDF_SUCCESS) ||
+		(add_event(ctx, &line, married? "dv ": "m, dv ",
+			   famt->divc.date, famt->divc.plac) != GPDF_SUCCESS))
+		return GPDF_ERROR;
+	}
+    }
+
+    // Children
+
+    if (indp->nchi > 0)
+    {
+	char s[16];
+
+	sprintf(s, "c   %d", indp->nchi);
+
+	if (add_text(ctx, RUN_NORMAL, ++line, s, NULL) != GPDF_SUCCESS)
+	    return GPDF_ERROR;
+    }
+
+    // Death
+
+    return add_event(ctx, &line, "d   ", textp->deat.date,
+		     textp->deat.plac);
+}
+
+// Build the runs of text for all the individuals once, so drawing just
+// replays them and the records are never changed
+
+int render_individuals(gpdf_context *ctx)
+{
+    ctx->runindex = calloc(ctx->indindex + 1, sizeof(int));
+
+    if (ctx->runindex == NULL)
+	return GPDF_ERROR;
+
+    for (int i = 1; i < ctx->indindex; i++)
+    {
+	ctx->runindex[i] = ctx->nruns;
+
+	if ((individual(ctx, i)->id > 0) &&
+	    (render_individual(ctx, i) != GPDF_SUCCESS))
+	    return GPDF_ERROR;
+    }
+
+    ctx->runindex[ctx->indindex] = ctx->nruns;
+
+    return GPDF_SUCCESS;
+}
+
+// Width of a string in a font at 1 point. The strings are interned,
+// so each surname or place is only measured once in each font
+
+float text_width(gpdf_context *ctx, HPDF_Font fonts[], int font, int text)
+{
+    xindex *index = &ctx->widthhash;
+    unsigned int hash = ((unsigned int)text * 2 + font) * 2654435761u;
+    HPDF_TextWidth tw;
+    char *p;
+
+    for (unsigned int i = hash & (index->size - 1);
+	 (index->size > 0) && (index->slots[i].id > 0);
+	 i = (i + 1) & (index->size - 1))
+    {
+	measure *mp = &ctx->measures[index->slots[i].id - 1];
+
+	if ((index->slots[i].hash == hash) &&
+	    (mp->text == text) && (mp->font == font))
+	    return mp->width;
+    }
+
+    // Widths from libharu are in thousandths of the font size
+
+    p = string(ctx, text);
+    tw = HPDF_Font_TextWidth(fonts[font], (HPDF_BYTE *)p, strlen(p));
+
+    // Keep it if there's room, it can always be measured again
+
+    if (ctx->nmeasures == ctx->maxmeasures)
+    {
+	int size = (ctx->maxmeasures == 0)? SIZE_HASH: ctx->maxmeasures * 2;
+	measure *measures = realloc(ctx->measures, size * sizeof(measure));
+
+	if (measures == NULL)
+	    return tw.width / 1000.0;
+
+	ctx->measures = measures;
+	ctx->maxmeasures = size;
+    }
+
+    if (insert_index(index, hash, ctx->nmeasures + 1) == GPDF_SUCCESS)
+    {
+	ctx->measures[ctx->nmeasures].text = text;
+	ctx->measures[ctx->nmeasures].font = font;
+	ctx->measures[ctx->nmeasures].width = tw.width / 1000.0;
+	ctx->nmeasures++;
+    }
+
+    return tw.width / 1000.0;
+}
+
+// Measure the widest line of each individual at 1 point, layout can
+// then look it up in widths[] and scale it by the font size
+
+int measure_individuals(gpdf_context *ctx, HPDF_Font fonts[])
+{
+    ctx->widths = calloc(ctx->indindex, sizeof(float));
+
+    if (ctx->widths == NULL)
+	return GPDF_ERROR;
+
+    for (int i = 1; i < ctx->indindex; i++)
+    {
+	float width = 0;
+	int line = 0;
+
+	for (int j = ctx->runindex[i]; j < ctx->runindex[i + 1]; j++)
+	{
+	    run *runp = &ctx->runs[j];
+
+	    if (runp->line != line)
+	    {
+		line = runp->line;
+		width = 0;
+	    }
+
+	    width += text_width(ctx, fonts, runp->font, runp->text);
+
+	    if (ctx->widths[i] < width)
+		ctx->widths[i] = width;
+	}
+    }
+
+    return GPDF_SUCCESS;
+}
+
+// Bytes written to the content stream of a page so far. libHaru has
+// no call for it, so it comes from the page attributes, which are only
+// known to be laid out like this from 2.3 up to 2.4. Other versions
+// count nothing
+
+unsigned int content_size(HPDF_Page page)
+{
+#if defined(HPDF_VERSION_ID) && (HPDF_VERSION_ID >= 20300) && \
+    (HPDF_VERSION_ID < 20500)
+    HPDF_PageAttr attr = (HPDF_PageAttr)page->attr;
+
+    return attr->stream->size;
+#else
+    (void)page;
+    return 0;
+#endif
+}
+
+// Drawing goes through a canvas, which is either a libharu page, or
+// the content of a page kept in memory, that is written out to the
+// file as the page is finished. Then only the offsets of the objects
+// are kept, so memory doesn't grow with the content. Pages can be
+// drawn on canvases of their own on other threads
+
+// Write to the file, counting the bytes so the offsets of the objects
+// don't depend on ftell, whose long is only 32 bits on Windows
+
+void put_file(canvas *cv, const char *format, ...)
+{
+    va_list args;
+    int size;
+
+    va_start(args, format);
+    size = vfprintf(cv->file, format, args);
+    va_end(args);
+
+    if (size < 0)
+	cv->failed = true;
+
+    else
+	cv->offset += size;
+}
+
+void write_file(canvas *cv, const void *data, size_t size)
+{
+    if (fwrite(data, 1, size, cv->file) != size)
+	cv->failed = true;
+
+    cv->offset += size;
+}
+
+// Start an object in the file, noting where it is for the xref table
+
+int start_object(canvas *cv, int id)
+{
+    if (id >= cv->maxobjects)
+    {
+	int size = (cv->maxobjects == 0)? SIZE_OBJECTS: cv->maxobjects * 2;
+	uint64_t *offsets = realloc(cv->offsets, size * sizeof(uint64_t));
+
+	if (offsets == NULL)
+	    return GPDF_ERROR;
+
+	cv->offsets = offsets;
+	cv->maxobjects = size;
+    }
+
+    if (cv->nobjects < id)
+	cv->nobjects = id;
+
+    cv->offsets[id] = cv->offset;
+    put_file(cv, "%d 0 obj\n", id);
+
+    return GPDF_SUCCESS;
+}
+
+// Make room for more content, noting if there isn't any
+
+bool grow_content(canvas *cv, size_t size)
+{
+    if (cv->size + size > cv->maxsize)
+    {
+	size_t maxsize = (cv->maxsize == 0)? SIZE_HEAP: cv->maxsize * 2;
+	char *content;
+
+	while (maxsize < cv->size + size)
+	    maxsize *= 2;
+
+	content = realloc(cv->content, maxsize);
+
+	if (content == NULL)
+	{
+	    cv->failed = true;
+	    return false;
+	}
+
+	cv->content = content;
+	cv->maxsize = maxsize;
+    }
+
+    return true;
+}
+
+// Deflate the content written so far, finishing it off at the end of
+// the page
+
+void deflate_content(canvas *cv, int flush)
+{
+    do
+    {
+	if (!grow_content(cv, SIZE_POOL))
+	    return;
+
+	cv->zstream.next_out = (Bytef *)cv->content + cv->size;
+	cv->zstream.avail_out = cv->maxsize - cv->size;
+	deflate(&cv->zstream, flush);
+	cv->size = cv->maxsize - cv->zstream.avail_out;
+    } while (cv->zstream.avail_out == 0);
+}
+
+// Write to the content of a page, deflated if the content is being
+// compressed, otherwise as it is
+
+void write_content(canvas *cv, const void *data, size_t size)
+{
+    if (cv->deflate)
+    {
+	cv->zstream.next_in = (Bytef *)data;
+	cv->zstream.avail_in = size;
+	deflate_content(cv, Z_NO_FLUSH);
+    }
+
+    else if (grow_content(cv, size))
+    {
+	memcpy(cv->content + cv->size, data, size);
+	cv->size += size;
+    }
+}
+
+// Write a page operator
+
+void put_content(canvas *cv, const char *format, ...)
+{
+    char buffer[SIZE_LINE];
+    va_list args;
+    int size;
+
+    va_start(args, format);
+    size = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    write_content(cv, buffer, size);
+}
+
+// Write a string, escaping the characters that need it
+
+void put_string(canvas *cv, const char *text)
+{
+    char buffer[SIZE_LINE];
+    int size = 0;
+
+    buffer[size++] = '(';
+
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++)
+    {
+	// Leave room for an escape and the closing bracket
+
+	if (size > SIZE_LINE - 8)
+	{
+	    write_content(cv, buffer, size);
+	    size = 0;
+	}
+
+	if ((*p == '(') || (*p == ')') || (*p == '\\'))
+	    size += sprintf(&buffer[size], "\\%c", *p);
+
+	else if ((*p < ' ') || (*p > '~'))
+	    size += sprintf(&buffer[size], "\\%03o", *p);
+
+	else
+	    buffer[size++] = *p;
+    }
+
+    buffer[size++] = ')';
+    write_content(cv, buffer, size);
+}
+
+// Page operators, to libharu or to the content
+
+void set_line_width(canvas *cv, float width)
+{
+    if (!cv->raw)
+	HPDF_Page_SetLineWidth(cv->page, width);
+
+    else
+	put_content(cv, "%.2f w\n", width);
+}
+
+void rectangle(canvas *cv, float x, float y, float width, float height)
+{
+    if (!cv->raw)
+	HPDF_Page_Rectangle(cv->page, x, y, width, height);
+
+    else
+	put_content(cv, "%.2f %.2f %.2f %.2f re\n", x, y, width, height);
+}
+
+void move_to(canvas *cv, float x, float y)
+{
+    if (!cv->raw)
+	HPDF_Page_MoveTo(cv->page, x, y);
+
+    else
+	put_content(cv, "%.2f %.2f m\n", x, y);
+}
+
+void line_to(canvas *cv, float x, float y)
+{
+    if (!cv->raw)
+	HPDF_Page_LineTo(cv->page, x, y);
+
+    else
+	put_content(cv, "%.2f %.2f l\n", x, y);
+}
+
+void stroke(canvas *cv)
+{
+    if (!cv->raw)
+	HPDF_Page_Stroke(cv->page);
+
+    else
+	put_content(cv, "S\n");
+}
+
+// Open the file and write the catalog and the fonts, the page tree and
+// the info go at the end once the pages are known
+
+int open_canvas(canvas *cv, char *filename)
+{
+    cv->file = fopen(filename, "wb");
+    cv->raw = true;
+
+    if (cv->file == NULL)
+    {
+	fprintf(stderr, "%s: can't write to %s\n", progname, filename);
+	return GPDF_ERROR;
+    }
+
+    put_file(cv, "%%PDF-1.4\n%%\xe2\xe3\xcf\xd3\n");
+
+    if (start_object(cv, OBJ_CATALOG) != GPDF_SUCCESS)
+	return GPDF_ERROR;
+
+    put_file(cv, "<< /Type /Catalog /Pages %d 0 R >>\nendobj\n", OBJ_PAGES);
+
+    if (start_object(cv, OBJ_FONT) != GPDF_SUCCESS)
+	return GPDF_ERROR;
+
+    put_file(cv, "<< /Type /Font /Subtype /Type1 /BaseFont /%s >>\n"
+	     "endobj\n", FONT);
+
+    if (start_object(cv, OBJ_BOLD) != GPDF_SUCCESS)
+	return GPDF_ERROR;
+
+    put_file(cv, "<< /Type /Font /Subtype /Type1 /BaseFont /%s >>\n"
+	     "endobj\n", BOLD);
+
+    if (cv->failed)
+	return GPDF_ERROR;
+
+    // A form for each combination of ticks, placed on each individual
+
+    for (int tick = TICK_FAMC; tick <= TICK_BOTH; tick++)
+    {
+	char content[SIZE_LINE];
+	int size = 0;
+
+	if (tick & TICK_FAMC)
+	    size += sprintf(&content[size], "%.2f 0 m\n%.2f 0 l\n",
+			    cv->slotwidth - (SIZE_INSET * 2),
+			    cv->slotwidth - SIZE_INSET);
+
+	if (tick & TICK_FAMS)
+	    size += sprintf(&content[size], "0 0 m\n%d 0 l\n", -SIZE_INSET);
+
+	size += sprintf(&content[size], "S\n");
+
+	if (start_object(cv, OBJ_TICKS + tick - 1) != GPDF_SUCCESS)
+	    return GPDF_ERROR;
+
+	put_file(cv, "<< /Type /XObject /Subtype /Form "
+		 "/BBox [%d -1 %.2f 1]\n/Length %d >>\nstream\n%s"
+		 "endstream\nendobj\n", -SIZE_INSET - 1,
+		 cv->slotwidth - SIZE_INSET + 1, size, content);
+    }
 
-	    id = find_individual(xref);
+    cv->nobjects = OBJ_FIRST - 1;
 
-	    if (id == 0)
-	    {
-		fprintf(stderr, "%s: Can't find slot for '%s'\n",
-			progname, second);
-		return GPDF_ERROR;
-	    }
+    // Page content is deflated as it's written
 
-	    famp->chil[++chln] = &inds[id];
-	}
+    if (cv->compress && (deflateInit(&cv->zstream, Z_DEFAULT_COMPRESSION) !=
+			 Z_OK))
+	return GPDF_ERROR;
 
-	else if (strcmp(first, "MARR") == 0)
-	{
-	    famp->marr.yes = true;
-	    date = DATE_MARR;
-	    plac = PLAC_MARR;
-	}
+    return GPDF_SUCCESS;
+}
 
-	else if (strcmp(first, "DIV") == 0)
-	{
-	    famp->divc.yes = true;
-	    date = DATE_DIVC;
-	    plac = PLAC_DIVC;
-	}
+// Set up a canvas to draw pages in memory for a streamed file, for
+// another thread to draw on
 
-	else
-	{
-	    date = DATE_NONE;
-	    plac = PLAC_NONE;
-	}
-	break;
+int init_canvas(canvas *pv, canvas *cv)
+{
+    *pv = (canvas){};
+
+    pv->pdf = cv->pdf;
+    pv->fonts[RUN_NORMAL] = cv->fonts[RUN_NORMAL];
+    pv->fonts[RUN_BOLD] = cv->fonts[RUN_BOLD];
+    pv->width = cv->width;
+    pv->height = cv->height;
+    pv->slotwidth = cv->slotwidth;
+    pv->compress = cv->compress;
+    pv->raw = true;
+
+    if (pv->compress && (deflateInit(&pv->zstream, Z_DEFAULT_COMPRESSION) !=
+			 Z_OK))
+	return GPDF_ERROR;
+
+    return GPDF_SUCCESS;
+}
+
+void free_canvas(canvas *pv)
+{
+    free(pv->content);
+
+    if (pv->compress)
+	deflateEnd(&pv->zstream);
+}
+
+// Start a page, with its border. A libharu page is added to the
+// document, a page in memory starts off empty
+
+int add_page(canvas *cv)
+{
+    if (!cv->raw)
+    {
+	cv->page = HPDF_AddPage(cv->pdf);
+
+	HPDF_Page_SetWidth(cv->page, cv->width);
+	HPDF_Page_SetHeight(cv->page, cv->height);
+    }
+
+    else
+    {
+	cv->size = 0;
+	cv->deflate = cv->compress;
     }
 
+    set_line_width(cv, 0.6);
+    rectangle(cv, SIZE_MARGIN, SIZE_MARGIN, cv->width - (2 * SIZE_MARGIN),
+	      cv->height - (2 * SIZE_MARGIN));
+
     return GPDF_SUCCESS;
 }
 
-int attrib(char *first, char *second)
+// Write a page drawn in memory to the file, the page and then its
+// content
+
+int write_page(canvas *cv, canvas *pv)
 {
-    switch (state)
+    int id = cv->nobjects + 1;
+
+    if (cv->nkids == cv->maxkids)
     {
-	// Individual
+	int size = (cv->maxkids == 0)? SIZE_OBJECTS: cv->maxkids * 2;
+	int *kids = realloc(cv->kids, size * sizeof(int));
 
-    case STATE_INDI:
-	if (strcmp(first, "GIVN") == 0)
-	{
-	    strncpy(indp->givn, second, SIZE_GIVN - 1);
-	}
+	if (kids == NULL)
+	    return GPDF_ERROR;
 
-	else if (strcmp(first, "SURN") == 0)
-	{
-	    strncpy(indp->surn, second, SIZE_SURN - 1);
-	}
+	cv->kids = kids;
+	cv->maxkids = size;
+    }
+
+    cv->kids[cv->nkids++] = id;
+
+    if (start_object(cv, id) != GPDF_SUCCESS)
+	return GPDF_ERROR;
+
+    put_file(cv, "<< /Type /Page /Parent %d 0 R "
+	     "/MediaBox [0 0 %.2f %.2f]\n/Resources << /Font << "
+	     "/F1 %d 0 R /F2 %d 0 R >>\n/XObject << /T%d %d 0 R /T%d %d 0 R "
+	     "/T%d %d 0 R >> >>\n/Contents %d 0 R >>\nendobj\n",
+	     OBJ_PAGES, cv->width, cv->height, OBJ_FONT, OBJ_BOLD,
+	     TICK_FAMC, OBJ_TICKS, TICK_FAMS, OBJ_TICKS + 1, TICK_BOTH,
+	     OBJ_TICKS + 2, id + 1);
+
+    if (start_object(cv, id + 1) != GPDF_SUCCESS)
+	return GPDF_ERROR;
+
+    put_file(cv, "<< /Length %zu%s >>\nstream\n", pv->size,
+	     (pv->compress)? " /Filter /FlateDecode": "");
+    write_file(cv, pv->content, pv->size);
+    put_file(cv, "\nendstream\nendobj\n");
+
+    return cv->failed? GPDF_ERROR: GPDF_SUCCESS;
+}
+
+// Finish a page, counting its content. A page in memory has the rest
+// of its content deflated, and is written out if there's a file
+
+int end_page(canvas *cv)
+{
+    if (!cv->raw)
+    {
+	cv->bytes += content_size(cv->page);
+	return GPDF_SUCCESS;
+    }
+
+    if (cv->deflate)
+    {
+	deflate_content(cv, Z_FINISH);
+	cv->bytes += cv->zstream.total_in;
+	cv->deflate = false;
+	deflateReset(&cv->zstream);
+    }
 
-	else if (strcmp(first, "NICK") == 0)
+    else
+	cv->bytes += cv->size;
+
+    if (cv->failed)
+	return GPDF_ERROR;
+
+    return (cv->file != NULL)? write_page(cv, cv): GPDF_SUCCESS;
+}
+
+// Write the page tree, the info and the xref table, and close the file
+
+int close_canvas(canvas *cv, char *title)
+{
+    uint64_t xref;
+    int status;
+
+    // The objects are already numbered, so there's room for them
+
+    start_object(cv, OBJ_PAGES);
+    put_file(cv, "<< /Type /Pages /Count %d /Kids [", cv->nkids);
+
+    for (int i = 0; i < cv->nkids; i++)
+	put_file(cv, "%s%d 0 R", (i % 8)? " ": "\n", cv->kids[i]);
+
+    put_file(cv, " ] >>\nendobj\n");
+
+    // The title is escaped in the content, there are no more pages
+
+    cv->size = 0;
+    put_string(cv, title);
+
+    start_object(cv, OBJ_INFO);
+    put_file(cv, "<< /Title ");
+    write_file(cv, cv->content, cv->size);
+    put_file(cv, " /Producer (gpdf) >>\nendobj\n");
+
+    xref = cv->offset;
+    put_file(cv, "xref\n0 %d\n0000000000 65535 f\r\n", cv->nobjects + 1);
+
+    for (int i = 1; i <= cv->nobjects; i++)
+	put_file(cv, "%010" PRIu64 " 00000 n\r\n", cv->offsets[i]);
+
+    put_file(cv, "trailer\n<< /Size %d /Root %d 0 R /Info %d 0 R >>\n"
+	     "startxref\n%" PRIu64 "\n%%%%EOF\n", cv->nobjects + 1,
+	     OBJ_CATALOG, OBJ_INFO, xref);
+
+    status = (cv->failed || ferror(cv->file))? GPDF_ERROR: GPDF_SUCCESS;
+
+    if (fclose(cv->file) != 0)
+	status = GPDF_ERROR;
+
+    free(cv->offsets);
+    free(cv->kids);
+    free_canvas(cv);
+
+    return status;
+}
+
+// Draw the ticks of an individual, placing the form that has them in
+// the file
+
+void draw_tick(canvas *cv, int tick, float x, float y)
+{
+    if (!cv->raw)
+    {
+	if (tick & TICK_FAMC)
 	{
-	    strncpy(indp->nick, second, SIZE_NICK - 1);
+	    move_to(cv, x + cv->slotwidth - (SIZE_INSET * 2), y);
+	    line_to(cv, x + cv->slotwidth - SIZE_INSET, y);
 	}
 
-	else if (strcmp(first, "_MARNM") == 0)
+	if (tick & TICK_FAMS)
 	{
-	    strncpy(indp->marn, second, SIZE_NAME - 1);
+	    move_to(cv, x, y);
+	    line_to(cv, x - SIZE_INSET, y);
 	}
+    }
 
-	else if (strcmp(first, "DATE") == 0)
-	{
-	    switch (date)
-	    {
-	    case DATE_BIRT:
-		strncpy(indp->birt.date, second, SIZE_DATE - 1);
-		break;
+    else
+	put_content(cv, "q 1 0 0 1 %.2f %.2f cm /T%d Do Q\n", x, y, tick);
+}
 
-	    case DATE_DEAT:
-		strncpy(indp->deat.date, second, SIZE_DATE - 1);
-		break;
-	    }
-	}
+// Save the state, clip to a box and move the origin
 
-	else if (strcmp(first, "PLAC") == 0)
-	{
-	    switch (plac)
-	    {
-	    case PLAC_BIRT:
-		strncpy(indp->birt.plac, second, SIZE_PLAC - 1);
-		break;
+void clip_to(canvas *cv, float x, float y, float width, float height,
+	     float dx, float dy)
+{
+    if (!cv->raw)
+    {
+	HPDF_Page_GSave(cv->page);
+	HPDF_Page_Rectangle(cv->page, x, y, width, height);
+	HPDF_Page_Clip(cv->page);
+	HPDF_Page_EndPath(cv->page);
+	HPDF_Page_Concat(cv->page, 1, 0, 0, 1, dx, dy);
+    }
 
-	    case PLAC_DEAT:
-		strncpy(indp->deat.plac, second, SIZE_PLAC - 1);
-		break;
-	    }
-	}
-	break;
+    else
+	put_content(cv, "q\n%.2f %.2f %.2f %.2f re\nW n\n"
+		"1 0 0 1 %.2f %.2f cm\n", x, y, width, height, dx, dy);
+}
 
-	// Family
+void unclip(canvas *cv)
+{
+    if (!cv->raw)
+	HPDF_Page_GRestore(cv->page);
 
-    case STATE_FAML:
-	if (strcmp(first, "DATE") == 0)
-	{
-	    switch (date)
-	    {
-	    case DATE_MARR:
-		strncpy(famp->marr.date, second, SIZE_DATE - 1);
-		break;
+    else
+	put_content(cv, "Q\n");
+}
 
-	    case DATE_DIVC:
-		strncpy(famp->divc.date, second, SIZE_DATE - 1);
-		break;
-	    }
-	}
+// Text operators, the file keeps track of the start of the line, as
+// positions are relative to it
+
+void begin_text(canvas *cv)
+{
+    if (!cv->raw)
+	HPDF_Page_BeginText(cv->page);
+
+    else
+    {
+	put_content(cv, "BT\n");
+	cv->textx = cv->texty = 0;
+    }
+}
+
+void end_text(canvas *cv)
+{
+    if (!cv->raw)
+	HPDF_Page_EndText(cv->page);
+
+    else
+	put_content(cv, "ET\n");
+}
+
+void set_font(canvas *cv, int font, float size)
+{
+    if (!cv->raw)
+	HPDF_Page_SetFontAndSize(cv->page, cv->fonts[font], size);
+
+    else
+	put_content(cv, "/F%d %.2f Tf\n", font + 1, size);
+}
+
+// Positions in the content are written to a hundredth of a point, the
+// position kept is rounded the same, so it stays where the text is
+
+float round_point(float x)
+{
+    return roundf(x * 100) / 100;
+}
+
+void move_text(canvas *cv, float dx, float dy)
+{
+    if (!cv->raw)
+	HPDF_Page_MoveTextPos(cv->page, dx, dy);
+
+    else
+    {
+	dx = round_point(dx);
+	dy = round_point(dy);
+
+	put_content(cv, "%.2f %.2f Td\n", dx, dy);
+	cv->textx += dx;
+	cv->texty += dy;
+    }
+}
+
+void show_text(canvas *cv, const char *text)
+{
+    if (!cv->raw)
+	HPDF_Page_ShowText(cv->page, text);
+
+    else
+    {
+	put_string(cv, text);
+	put_content(cv, " Tj\n");
+    }
+}
+
+void text_out(canvas *cv, float x, float y, const char *text)
+{
+    if (!cv->raw)
+	HPDF_Page_TextOut(cv->page, x, y, text);
+
+    // Place the text absolutely, so nothing carries over from the text
+    // before
+
+    else
+    {
+	cv->textx = round_point(x);
+	cv->texty = round_point(y);
+
+	put_content(cv, "1 0 0 1 %.2f %.2f Tm\n", cv->textx, cv->texty);
+	show_text(cv, text);
+    }
+}
+
+// Width of some text in a font
 
-	else if (strcmp(first, "PLAC") == 0)
+float canvas_text_width(canvas *cv, int font, float size, const char *text)
+{
+    HPDF_TextWidth tw;
+
+    if (!cv->raw)
+	return HPDF_Page_TextWidth(cv->page, text);
+
+    tw = HPDF_Font_TextWidth(cv->fonts[font], (HPDF_BYTE *)text,
+			     strlen(text));
+
+    return tw.width * size / 1000;
+}
+
+// Draw individual info, for those in the list, or all of them
+
+int draw_individuals(gpdf_context *ctx, canvas *cv,
+		     float fontsize, float height,
+		     float slotwidth, float slotheight,
+		     int *list, int count)
+{
+    int current = RUN_NORMAL;
+
+    set_font(cv, RUN_NORMAL, fontsize);
+    begin_text(cv);
+
+    // Iterate through the individuals in the list, or all of them
+
+    for (int k = 0; k < count; k++)
+    {
+	int i = (list != NULL)? list[k]: k + 1;
+	indi *indp = individual(ctx, i);
+
+	// Check the position
+
+	if ((indp->id > 0) && (indp->posn.y > 0))
 	{
-	    switch (plac)
+	    float x = (SIZE_MARGIN + (SIZE_INSET * 2)) +
+		(indp->posn.x * slotwidth);
+	    float y = height - SIZE_MARGIN -
+		(indp->posn.y * slotheight);
+	    int line = 0;
+
+	    // Replay the runs, the first one places the text
+
+	    for (int j = ctx->runindex[i]; j < ctx->runindex[i + 1]; j++)
 	    {
-	    case PLAC_MARR:
-		strncpy(famp->marr.plac, second, SIZE_PLAC - 1);
-		break;
+		run *runp = &ctx->runs[j];
 
-	    case PLAC_DIVC:
-		strncpy(famp->divc.plac, second, SIZE_PLAC - 1);
-		break;
+		if (runp->font != current)
+		{
+		    current = runp->font;
+		    set_font(cv, current, fontsize);
+		}
+
+		if (j == ctx->runindex[i])
+		    text_out(cv, x, y - (runp->line * fontsize),
+			     string(ctx, runp->text));
+
+		else
+		{
+		    if (runp->line > line)
+			move_text(cv, 0, (line - runp->line) * fontsize);
+
+		    show_text(cv, string(ctx, runp->text));
+		}
+
+		line = runp->line;
 	    }
 	}
-	break;
     }
 
+    end_text(cv);
+
     return GPDF_SUCCESS;
 }
 
-void traverse(faml *famp, int n, bool debug)
+// Add a family line, growing the list as needed
+
+int add_line(gpdf_context *ctx, float x0, float y0, float x1, float y1)
 {
-    if (famp != NULL)
+    if (ctx->nsegments == ctx->maxsegments)
     {
-	if (famp->wife != NULL)
+	int size = (ctx->maxsegments == 0)? SIZE_SEGMENTS:
+	    ctx->maxsegments * 2;
+	lineseg *segments = realloc(ctx->segments, size * sizeof(lineseg));
+
+	if (segments == NULL)
+	    return GPDF_ERROR;
+
+	ctx->segments = segments;
+	ctx->maxsegments = size;
+    }
+
+    ctx->segments[ctx->nsegments++] = (lineseg){x0, y0, x1, y1};
+
+    return GPDF_SUCCESS;
+}
+
+// Find the family lines, in the order they are drawn, so tiled pages
+// can pick out the ones that cross them. The famc and fams ticks go
+// with the individuals
+
+int find_family_lines(gpdf_context *ctx, float height,
+		      float slotwidth, float slotheight)
+{
+    ctx->nsegments = 0;
+
+    // Lines from wife to chilren
+
+    for (int i = 1; i < ctx->famindex; i++)
+    {
+	faml *famp = family(ctx, i);
+
+	if ((famp->wife != NULL) &&
+	    (famp->wife->posn.y > 0))
 	{
-	    if (famp->wife->gens < n)
-		famp->wife->gens = n;
+	    float wx = (SIZE_MARGIN + SIZE_INSET) +
+		(famp->wife->posn.x * slotwidth);
+	    float wy = height - SIZE_MARGIN -
+		(famp->wife->posn.y * slotheight);
 
-	    traverse(famp->wife->famc, n + 1, debug);
+	    for (int j = ctx->children.index[i];
+		 j < ctx->children.index[i + 1]; j++)
+	    {
+		indi *chil = individual(ctx, ctx->children.list[j]);
+
+		if (chil->posn.y > 0)
+		{
+		    float cx = (SIZE_MARGIN + SIZE_INSET) + slotwidth +
+			(chil->posn.x * slotwidth);
+		    float cy = height - SIZE_MARGIN -
+			(chil->posn.y * slotheight);
 
-	    if (debug)
-		printf("INDI: %s, GENS: %d\n", famp->wife->name, n);
+		    if (add_line(ctx, wx, wy, cx, cy) != GPDF_SUCCESS)
+			return GPDF_ERROR;
+		}
+	    }
 	}
 
-	if (famp->husb != NULL)
+	// Lines from husband to children
+
+	if ((famp->husb != NULL) &&
+	    (famp->husb->posn.y > 0))
+	{
+	    float hx = (SIZE_MARGIN + SIZE_INSET) +
+		(famp->husb->posn.x * slotwidth);
+	    float hy = height - SIZE_MARGIN -
+		(famp->husb->posn.y * slotheight);
+
+	    for (int j = ctx->children.index[i];
+		 j < ctx->children.index[i + 1]; j++)
+	    {
+		indi *chil = individual(ctx, ctx->children.list[j]);
+
+		if (chil->posn.y > 0)
+		{
+		    float cx = (SIZE_MARGIN + SIZE_INSET) + slotwidth +
+			(chil->posn.x * slotwidth);
+		    float cy = height - SIZE_MARGIN -
+			(chil->posn.y * slotheight);
+
+		    if (add_line(ctx, hx, hy, cx, cy) != GPDF_SUCCESS)
+			return GPDF_ERROR;
+		}
+	    }
+	}
+
+	// Lines from wife to husband
+
+	if ((famp->wife != NULL) && (famp->husb != NULL) &&
+	    (famp->wife->posn.y > 0) &&
+	    (famp->husb->posn.y > 0))
 	{
-	    if (famp->husb->gens < n)
-		famp->husb->gens = n;
+	    float wx = (SIZE_MARGIN + SIZE_INSET) +
+		(famp->wife->posn.x * slotwidth);
+	    float wy = height - SIZE_MARGIN -
+		(famp->wife->posn.y * slotheight);
 
-	    traverse(famp->husb->famc, n + 1, debug);
+	    float hx = (SIZE_MARGIN + SIZE_INSET) +
+		(famp->husb->posn.x * slotwidth);
+	    float hy = height - SIZE_MARGIN -
+		(famp->husb->posn.y * slotheight);
 
-	    if (debug)
-		printf("INDI: %s, GENS: %d\n", famp->husb->name, n);
+	    if (add_line(ctx, hx, hy, wx, wy) != GPDF_SUCCESS)
+		return GPDF_ERROR;
 	}
     }
+
+    return GPDF_SUCCESS;
 }
 
-int find_generations()
+// The famc and fams ticks an individual has
+
+int individual_ticks(gpdf_context *ctx, int i)
 {
-    // Iterate through the individuals
+    indi *indp = individual(ctx, i);
+    int tick = 0;
 
-    for (int i = 1; i < indindex; i++)
-    {
-	bool debug = false;
+    if (indp->famc != NULL)
+	tick |= TICK_FAMC;
 
-	if (inds[i].id > 0)
-	{
-	    // if (strcmp(inds[i].xref, "I2") == 0)
-	    // 	debug = true;
+    if (ctx->families.index[i + 1] > ctx->families.index[i])
+	tick |= TICK_FAMS;
+
+    return tick;
+}
 
-	    // If they have parents
+// Draw the famc and fams ticks of the individuals in the list, or all
+// of them
 
-	    if (inds[i].famc != NULL)
-		traverse(inds[i].famc, 1, debug);
+void draw_ticks(gpdf_context *ctx, canvas *cv, float height,
+		float slotwidth, float slotheight, int *list, int count)
+{
+    int drawn = 0;
 
-	    // Remember generations
+    for (int k = 0; k < count; k++)
+    {
+	int i = (list != NULL)? list[k]: k + 1;
+	indi *indp = individual(ctx, i);
+	int tick;
 
-	    if (gens < inds[i].gens)
-	    	gens = inds[i].gens;
+	if ((indp->id > 0) && (indp->posn.y > 0) &&
+	    ((tick = individual_ticks(ctx, i)) != 0))
+	{
+	    float x = (SIZE_MARGIN + (SIZE_INSET * 2)) +
+		(indp->posn.x * slotwidth);
+	    float y = height - SIZE_MARGIN -
+		(indp->posn.y * slotheight);
 
-	    if (debug)
-		printf("INDI: %s, GENS: %d\n", inds[i].name, inds[i].gens);
+	    draw_tick(cv, tick, x, y);
+	    drawn++;
 	}
     }
 
-    // Iterate through the individuals
+    // Ticks drawn as paths are stroked together, forms stroke their own
+
+    if (!cv->raw && (drawn > 0))
+	stroke(cv);
+}
+
+// Draw family lines, they are all the same width so they go into one
+// path which is stroked once at the end. Draw all of them if there's
+// no list
 
-    for (int i = 1; i < indindex; i++)
+void draw_lines(gpdf_context *ctx, canvas *cv, int *list, int count)
+{
+    for (int i = 0; i < count; i++)
     {
-    	if (inds[i].id > 0)
-    	{
-	    if (inds[i].famc != NULL)
-	    {
-		// Check mother
+	lineseg *segp = &ctx->segments[(list != NULL)? list[i]: i];
 
-		if ((inds[i].famc->wife != NULL) &&
-		    (inds[i].gens < inds[i].famc->wife->gens - 1))
-		    inds[i].gens = inds[i].famc->wife->gens - 1;
+	move_to(cv, segp->x0, segp->y0);
+	line_to(cv, segp->x1, segp->y1);
+    }
 
-		// Check father
+    // An empty path can't be stroked
 
-		if ((inds[i].famc->husb != NULL) &&
-		    (inds[i].gens < inds[i].famc->husb->gens - 1))
-		    inds[i].gens = inds[i].famc->husb->gens - 1;
-	    }
+    if (count > 0)
+	stroke(cv);
+}
 
-	    // Calculate x position on page
+// Find the tiles whose windows overlap a span of the chart. Window k
+// starts at margin + k * step and is span long
 
-	    inds[i].posn.x = inds[i].gens;
-	}
-    }
+void tile_range(float lo, float hi, float step, float span, int n,
+		int *first, int *last)
+{
+    *first = ceilf((lo - SIZE_MARGIN - span) / step);
+    *last = floorf((hi - SIZE_MARGIN) / step);
 
-    // Iterate through the individuals
+    if (*first < 0)
+	*first = 0;
 
-    for (int i = 1; i < indindex; i++)
-    {
-    	if (inds[i].id > 0)
-    	{
-    	    // If male
-
-    	    if (inds[i].sex[0] == 'M')
-    	    {
-    		// See if a wife has more generations
-
-    		for (int j = 0; j < SIZE_FMSS; j++)
-    		{
-    		    if ((inds[i].fams[j] != NULL) &&
-    			(inds[i].fams[j]->wife != NULL) &&
-    			(inds[i].fams[j]->wife->gens > inds[i].gens))
-    			inds[i].gens = inds[i].fams[j]->wife->gens;
-    		}
-    	    }
-
-    	    else
-    	    {
-    		// See if a husband has more generations
-
-    		for (int j = 0; j < SIZE_FMSS; j++)
-    		{
-    		    if ((inds[i].fams[j] != NULL) &&
-    			(inds[i].fams[j]->husb != NULL) &&
-    			(inds[i].fams[j]->husb->gens > inds[i].gens))
-    			inds[i].gens = inds[i].fams[j]->husb->gens;
-    		}
-    	    }
-    	}
-    }
+    if (*last > n - 1)
+	*last = n - 1;
+}
 
-    // Iterate through the individuals
+// Check if a line crosses a box, by clipping the line to each side in
+// turn and seeing if any of it is left
 
-    for (int i = 1; i < indindex; i++)
+bool crosses(lineseg *segp, float x0, float y0, float x1, float y1)
+{
+    float dx = segp->x1 - segp->x0;
+    float dy = segp->y1 - segp->y0;
+    float p[4] = {-dx, dx, -dy, dy};
+    float q[4] = {segp->x0 - x0, x1 - segp->x0, segp->y0 - y0, y1 - segp->y0};
+    float enter = 0;
+    float leave = 1;
+
+    for (int i = 0; i < 4; i++)
     {
-    	if (inds[i].id > 0)
+	if (p[i] == 0)
+	{
+	    if (q[i] < 0)
+		return false;
+	}
 
-	    // Increment generation count
-	    genc[inds[i].gens]++;
+	else if (p[i] < 0)
+	    enter = fmaxf(enter, q[i] / p[i]);
+
+	else
+	    leave = fminf(leave, q[i] / p[i]);
     }
 
-    return GPDF_SUCCESS;
+    return enter <= leave;
 }
 
-int write_textfile()
-{
-    char filename[SIZE_LINE];
-    FILE *textfile;
+// Add an item to the tiles it overlaps, counting first, then filling
+// the rows once they have been started. Lines that only pass by a
+// corner of their box are left off the tiles they miss
 
-    strcpy(filename, file);
-    strcat(filename, ".txt");
+void tile_item(tiling *tp, csr *csr, int item, bool fill, lineseg *segp,
+	       float x0, float y0, float x1, float y1)
+{
+    int c0, c1, r0, r1;
 
-#ifndef __MINGW32__
-    textfile = fopen(filename, "wx");
-#else
-    // File open mode 'wx' not supported by windows, although in POSIX
-    // accorrding to Gnu C Library docs.
+    // Rows go down from the top of the chart
 
-    textfile = fopen(filename, "r");
+    tile_range(x0, x1, tp->stepx, tp->spanx, tp->cols, &c0, &c1);
+    tile_range(tp->chartheight - y1, tp->chartheight - y0, tp->stepy,
+	       tp->spany, tp->rows, &r0, &r1);
 
-    if (textfile != NULL)
+    for (int r = r0; r <= r1; r++)
     {
-	fclose(textfile);
-	fprintf(stderr, "%s: Not overwriting '%s'\n", progname, filename);
-	return GPDF_SUCCESS;
-    }
+	for (int c = c0; c <= c1; c++)
+	{
+	    int tile = (r * tp->cols) + c;
+	    float left = SIZE_MARGIN + (c * tp->stepx);
+	    float top = tp->chartheight - SIZE_MARGIN - (r * tp->stepy);
 
-    textfile = fopen(filename, "w");
-#endif
-    if (textfile == NULL)
-    {
-	fprintf(stderr, "%s: cant't write to %s\n", progname, filename);
-	return GPDF_SUCCESS;
-    }
+	    if ((segp != NULL) && !crosses(segp, left, top - tp->spany,
+					   left + tp->spanx, top))
+		continue;
 
-    fprintf(textfile, "   0        posn  suggested\n");
-    fprintf(textfile, "   0  xref  x  y      x      Name\n");
+	    if (fill)
+		csr->list[csr->index[tile]++] = item;
 
-    for (int i = 1; i < SIZE_INDS; i++)
-    {
-	if (inds[i].id > 0)
-	{
-	    fprintf(textfile, "%4d  %-4s %2.0f %4.1f   %2d      %s\n",
-		    inds[i].id, inds[i].xref, inds[i].posn.x, inds[i].posn.y,
-		    inds[i].gens, inds[i].name);
+	    else
+		csr->index[tile + 1]++;
 	}
     }
-
-    fclose(textfile);
-
-    return GPDF_SUCCESS;
 }
 
-int read_textfile()
+// Box round the text of an individual
+
+void individual_box(gpdf_context *ctx, int i, float height,
+		    float slotwidth, float slotheight, float box[4])
 {
-    char filename[SIZE_NAME];
-    char line[SIZE_LINE];
-    char *linep = line;
-    size_t size = sizeof(line);
-    FILE *textfile;
-    float slots = 0;
+    indi *indp = individual(ctx, i);
+    float x = (SIZE_MARGIN + (SIZE_INSET * 2)) + (indp->posn.x * slotwidth);
+    float y = height - SIZE_MARGIN - (indp->posn.y * slotheight);
+    int lines = (ctx->runindex[i + 1] > ctx->runindex[i])?
+	ctx->runs[ctx->runindex[i + 1] - 1].line + 1: 0;
 
-    if (readtext)
-	strcpy(filename, text);
+    int tick = individual_ticks(ctx, i);
 
-    else
-    {
-	strcpy(filename, file);
-	strcat(filename, ".txt");
-    }
+    box[0] = (tick & TICK_FAMS)? x - SIZE_INSET: x;
+    box[1] = y - (lines * fontsize);
+    box[2] = x + (ctx->widths[i] * fontsize);
+    box[3] = y + fontsize;
 
-    textfile = fopen(filename, "r");
+    // The famc tick is at the far end of the slot
 
-    if (textfile == NULL)
-    {
-	fprintf(stderr, "%s: can't read '%s'\n", progname, filename);
+    if ((tick & TICK_FAMC) && (box[2] < x + slotwidth - SIZE_INSET))
+	box[2] = x + slotwidth - SIZE_INSET;
+}
+
+// Index the individuals and lines by the tiles they fall on, so each
+// page only goes through its own. Count them into each tile, then fill
+// the rows in a second pass
+
+int index_tiles(gpdf_context *ctx, tiling *tp, float slotwidth,
+		float slotheight)
+{
+    int tiles = tp->cols * tp->rows;
+
+    if ((start_csr(&tp->inds, tiles) != GPDF_SUCCESS) ||
+	(start_csr(&tp->lines, tiles) != GPDF_SUCCESS))
 	return GPDF_ERROR;
-    }
 
-    while (getline(&linep, &size, textfile) != -1)
+    for (int pass = 0; pass < 2; pass++)
     {
-	int id = 0;
-	char xref[SIZE_XREF];
-	float x = 0;
-	float y = 0;
+	bool fill = (pass == 1);
 
-	// Parse first four fields, ignore the rest
-
-	sscanf(line, " %d %s %f %f", &id, xref, &x, &y);
+	if (fill && ((fill_csr(&tp->inds, tiles) != GPDF_SUCCESS) ||
+		     (fill_csr(&tp->lines, tiles) != GPDF_SUCCESS)))
+	    return GPDF_ERROR;
 
-	if (id > 0)
+	for (int i = 1; i < ctx->indindex; i++)
 	{
-	    id = find_individual(xref);
+	    indi *indp = individual(ctx, i);
+	    float box[4];
 
-	    if (id > 0)
-	    {
-		inds[id].posn.x = x;
-		inds[id].posn.y = y;
+	    if ((indp->id <= 0) || (indp->posn.y <= 0))
+		continue;
 
-		if (slots < y)
-		    slots = y;
-	    }
+	    individual_box(ctx, i, tp->chartheight, slotwidth, slotheight,
+			   box);
+	    tile_item(tp, &tp->inds, i, fill, NULL,
+		      box[0], box[1], box[2], box[3]);
 	}
-    }
 
-    fclose(textfile);
+	for (int i = 0; i < ctx->nsegments; i++)
+	{
+	    lineseg *segp = &ctx->segments[i];
+
+	    tile_item(tp, &tp->lines, i, fill, segp,
+		      fminf(segp->x0, segp->x1), fminf(segp->y0, segp->y1),
+		      fmaxf(segp->x0, segp->x1), fmaxf(segp->y0, segp->y1));
+	}
+    }
 
-    slotmax = slots;
+    end_csr(&tp->inds, tiles);
+    end_csr(&tp->lines, tiles);
 
     return GPDF_SUCCESS;
 }
 
-// Error handler from examples
+// Draw the title box in the bottom right corner
 
-void error_handler(HPDF_STATUS error_no, HPDF_STATUS   detail_no,
-		   void *user_data __attribute__ ((unused)))
+void draw_title(canvas *cv, char *title, float width)
 {
-    fprintf (stderr, "%s: libHaru error_no = %04X, detail_no = %u\n",
-	     progname, (HPDF_UINT)error_no, (HPDF_UINT)detail_no);
+    HPDF_REAL tw;
 
-    longjmp(env, 1);
-}
+    rectangle(cv, width - 200 - SIZE_MARGIN, SIZE_MARGIN, 200, 22);
+    stroke(cv);
 
-// Draw individual info
+    // Draw the title of the page (with positioning center).
+    set_font(cv, RUN_NORMAL, 18);
 
-int draw_individuals(HPDF_Page page, HPDF_Font font, HPDF_Font bold,
-		     float fontsize, float height,
-		     float slotwidth, float slotheight)
-{
-    HPDF_Page_SetFontAndSize(page, font, fontsize);
-    HPDF_Page_BeginText(page);
+    tw = canvas_text_width(cv, RUN_NORMAL, 18, title);
+    begin_text(cv);
+    text_out(cv, (width - 100 - SIZE_MARGIN) - tw / 2, SIZE_MARGIN + 5,
+	     title);
+    end_text(cv);
+}
 
-    // Iterate through the individuals
+// Draw crop marks in the margin where the part of a tile that isn't
+// also on its neighbours starts and ends, so the pages can be trimmed
+// there and butted together, and label the tile
 
-    for (int i = 0; i < indindex; i++)
+void draw_crop_marks(canvas *cv, tiling *tp, int col, int row)
+{
+    float overlap = SIZE_OVERLAP / 2.0;
+    float left = SIZE_MARGIN + ((col > 0)? overlap: 0);
+    float right = tp->width - SIZE_MARGIN -
+	((col < tp->cols - 1)? overlap: 0);
+    float top = tp->height - SIZE_MARGIN - ((row > 0)? overlap: 0);
+    float bottom = SIZE_MARGIN + ((row < tp->rows - 1)? overlap: 0);
+    char label[SIZE_NAME];
+
+    for (int i = 0; i < 2; i++)
     {
-	if (inds[i].id > 0)
-	{
-	    // Check the position
-
-	    if (inds[i].posn.y > 0)
-	    {
-		float x = (SIZE_MARGIN + (SIZE_INSET * 2)) +
-		    (inds[i].posn.x * slotwidth);
-		float y = height - SIZE_MARGIN -
-		    (inds[i].posn.y * slotheight);
-
-		// Name
-
-		if (inds[i].givn[0] == '\0')
-		{
-		    char *givn;
-		    char *surn;
-		    char *endn;
-
-		    // Name
-
-		    givn = inds[i].name;
-		    surn = strchr(inds[i].name, '/');
-		    if (surn != NULL)
-			*surn = '\0';
-
-		    surn += 1;
-		    endn = strchr(surn, '/');
-		    if (endn != NULL)
-			*endn = '\0';
-
-		    HPDF_Page_TextOut(page, x, y, givn);
-		    HPDF_Page_SetFontAndSize(page, bold, fontsize);
-		    HPDF_Page_ShowText(page, surn);
-		    HPDF_Page_SetFontAndSize(page, font, fontsize);
-		}
+	float x = i? right: left;
+	float y = i? bottom: top;
+
+	// Marks along the top and bottom margins, and the sides
+
+	move_to(cv, x, 0);
+	line_to(cv, x, SIZE_MARK);
+	move_to(cv, x, tp->height - SIZE_MARK);
+	line_to(cv, x, tp->height);
+	move_to(cv, 0, y);
+	line_to(cv, SIZE_MARK, y);
+	move_to(cv, tp->width - SIZE_MARK, y);
+	line_to(cv, tp->width, y);
+    }
 
-		else
-		{
-		    // Given names surname
-
-		    HPDF_Page_TextOut(page, x, y, inds[i].givn);
-		    if (inds[i].nick[0] != '\0')
-		    {
-			HPDF_Page_ShowText(page, " '");
-			HPDF_Page_ShowText(page, inds[i].nick);
-			HPDF_Page_ShowText(page, "' ");
-		    }
-
-		    else
-			HPDF_Page_ShowText(page, " ");
-
-		    HPDF_Page_SetFontAndSize(page, bold, fontsize);
-		    HPDF_Page_ShowText(page, inds[i].surn);
-		    HPDF_Page_SetFontAndSize(page, font, fontsize);
-		}
+    stroke(cv);
 
-		// Birth
+    snprintf(label, sizeof(label), "Column %d of %d, row %d of %d",
+	     col + 1, tp->cols, row + 1, tp->rows);
 
-		if ((inds[i].birt.date[0] != '\0') &&
-		    (inds[i].birt.plac[0] != '\0'))
-		{
-		    HPDF_Page_MoveToNextLine(page);
-		    HPDF_Page_MoveTextPos(page, 0, -fontsize);
-		    HPDF_Page_ShowText(page, "b   ");
-		    HPDF_Page_ShowText(page, inds[i].birt.date);
-		    HPDF_Page_ShowText(page, " ");
-		    HPDF_Page_ShowText(page, inds[i].birt.plac);
-		}
+    set_font(cv, RUN_NORMAL, SIZE_FONT);
+    begin_text(cv);
+    text_out(cv, SIZE_MARGIN + SIZE_OVERLAP, tp->height - SIZE_MARGIN +
+	     (SIZE_FONT / 2), label);
+    end_text(cv);
+}
 
-		else if (inds[i].birt.date[0] != '\0')
-		{
-		    HPDF_Page_MoveToNextLine(page);
-		    HPDF_Page_MoveTextPos(page, 0, -fontsize);
-		    HPDF_Page_ShowText(page, "b   ");
-		    HPDF_Page_ShowText(page, inds[i].birt.date);	
-		}
+// Draw a tile of the chart on a page that has been started. Each page
+// shows a window of the chart, clipped to the border and moved into
+// place, with only the individuals and lines indexed to it
 
-		else if (inds[i].birt.plac[0] != '\0')
-		{
-		    HPDF_Page_MoveToNextLine(page);
-		    HPDF_Page_MoveTextPos(page, 0, -fontsize);
-		    HPDF_Page_ShowText(page, "b   ");
-		    HPDF_Page_ShowText(page, inds[i].birt.plac);	
-		}
+void draw_tile(gpdf_context *ctx, canvas *cv, tiling *tp, char *title,
+	       float slotwidth, float slotheight, int tile)
+{
+    int col = tile % tp->cols;
+    int row = tile / tp->cols;
 
-		// Occupation
+    // The title goes on the bottom right page
 
-		if (inds[i].occu[0] != '\0')
-		{
-		    HPDF_Page_MoveToNextLine(page);
-		    HPDF_Page_MoveTextPos(page, 0, -fontsize);
-		    HPDF_Page_ShowText(page, "o   ");
-		    HPDF_Page_ShowText(page, inds[i].occu);
-		}
+    if (tile == (tp->cols * tp->rows) - 1)
+	draw_title(cv, title, tp->width);
 
-		// Marriages and divorces
+    else
+	stroke(cv);
 
-		if (inds[i].sex[0] == 'F')
-		{
-		    for (int j = 0; j < SIZE_FMSS; j++)
-		    {
-			if (inds[i].fams[j] != NULL)
-			{
-			    faml *famp = inds[i].fams[j];
-
-			    if ((famp->marr.date[0] != '\0') &&
-				(famp->marr.plac[0] != '\0'))
-			    {
-				HPDF_Page_MoveToNextLine(page);
-				HPDF_Page_MoveTextPos(page, 0, -fontsize);
-				HPDF_Page_ShowText(page, "m  ");
-				HPDF_Page_ShowText(page, famp->marr.date);
-				HPDF_Page_ShowText(page, " ");
-				HPDF_Page_ShowText(page, famp->marr.plac);
-			    }
-
-			    else if (famp->marr.date[0] != '\0')
-			    {
-				HPDF_Page_MoveToNextLine(page);
-				HPDF_Page_MoveTextPos(page, 0, -fontsize);
-				HPDF_Page_ShowText(page, "m  ");
-				HPDF_Page_ShowText(page, famp->marr.date);	
-			    }
-
-			    else if (famp->marr.plac[0] != '\0')
-			    {
-				HPDF_Page_MoveToNextLine(page);
-				HPDF_Page_MoveTextPos(page, 0, -fontsize);
-				HPDF_Page_ShowTextNextLine(page, "m  ");
-				HPDF_Page_ShowText(page, famp->marr.plac);	
-			    }
-
-			    // else if (famp->marr.yes)
-			    // {
-			    //     HPDF_Page_MoveToNextLine(page);
-			    //     HPDF_Page_MoveTextPos(page, 0, -fontsize);
-			    //     HPDF_Page_ShowText(page, "m");
-			    // }
-
-			    if ((famp->divc.date[0] != '\0') &&
-				(famp->divc.plac[0] != '\0'))
-			    {
-				HPDF_Page_MoveToNextLine(page);
-				HPDF_Page_MoveTextPos(page, 0, -fontsize);
-				if ((famp->marr.date[0] == '\0') &&
-				    (famp->marr.plac[0] == '\0'))
-				    HPDF_Page_ShowText(page, "m, dv ");
-
-				else
-				    HPDF_Page_ShowText(page, "dv ");
-				HPDF_Page_ShowText(page, famp->divc.date);
-				HPDF_Page_ShowText(page, " ");
-				HPDF_Page_ShowText(page, famp->divc.plac);
-			    }
-
-			    else if (famp->divc.date[0] != '\0')
-			    {
-				HPDF_Page_MoveToNextLine(page);
-				HPDF_Page_MoveTextPos(page, 0, -fontsize);
-				if ((famp->marr.date[0] == '\0') &&
-				    (famp->marr.plac[0] == '\0'))
-				    HPDF_Page_ShowText(page, "m, dv ");
-
-				else
-				    HPDF_Page_ShowText(page, "dv ");
-				HPDF_Page_ShowText(page, famp->divc.date);	
-			    }
-
-			    else if (famp->divc.plac[0] != '\0')
-			    {
-				HPDF_Page_MoveToNextLine(page);
-				HPDF_Page_MoveTextPos(page, 0, -fontsize);
-				if ((famp->marr.date[0] == '\0') &&
-				    (famp->marr.plac[0] == '\0'))
-				    HPDF_Page_ShowText(page, "m, dv ");
-
-				else
-				    HPDF_Page_ShowTextNextLine(page, "dv ");
-				HPDF_Page_ShowText(page, famp->divc.plac);	
-			    }
-
-			    // else if (famp->divc.yes)
-			    // {
-			    //     HPDF_Page_ShowText(page, ", d");
-			    // }
-			}
-		    }
-		}
+    draw_crop_marks(cv, tp, col, row);
 
-		// Children
+    clip_to(cv, SIZE_MARGIN, SIZE_MARGIN, tp->width - (2 * SIZE_MARGIN),
+	    tp->height - (2 * SIZE_MARGIN), -col * tp->stepx,
+	    -(tp->chartheight - tp->height - (row * tp->stepy)));
 
-		if (inds[i].nchi > 0)
-		{
-		    char s[16];
+    draw_individuals(ctx, cv, fontsize, tp->chartheight, slotwidth,
+		     slotheight, &tp->inds.list[tp->inds.index[tile]],
+		     tp->inds.index[tile + 1] - tp->inds.index[tile]);
+    draw_ticks(ctx, cv, tp->chartheight, slotwidth, slotheight,
+	       &tp->inds.list[tp->inds.index[tile]],
+	       tp->inds.index[tile + 1] - tp->inds.index[tile]);
+    draw_lines(ctx, cv, &tp->lines.list[tp->lines.index[tile]],
+	       tp->lines.index[tile + 1] - tp->lines.index[tile]);
 
-		    HPDF_Page_MoveToNextLine(page);
-		    HPDF_Page_MoveTextPos(page, 0, -fontsize);
-		    sprintf(s, "c   %d", inds[i].nchi);
-		    HPDF_Page_ShowText(page, s);
-		}
+    unclip(cv);
+}
 
-		// Death
+// Draw pages of a batch, each on its own canvas
 
-		if ((inds[i].deat.date[0] != '\0') &&
-		    (inds[i].deat.plac[0] != '\0'))
-		{
-		    HPDF_Page_MoveToNextLine(page);
-		    HPDF_Page_MoveTextPos(page, 0, -fontsize);
-		    HPDF_Page_ShowText(page, "d   ");
-		    HPDF_Page_ShowText(page, inds[i].deat.date);
-		    HPDF_Page_ShowText(page, " ");
-		    HPDF_Page_ShowText(page, inds[i].deat.plac);
-		}
+void page_task(crew *cp)
+{
+    batch *bp = cp->arg;
+    int piece;
 
-		else if (inds[i].deat.date[0] != '\0')
-		{
-		    HPDF_Page_MoveToNextLine(page);
-		    HPDF_Page_MoveTextPos(page, 0, -fontsize);
-		    HPDF_Page_ShowText(page, "d   ");
-		    HPDF_Page_ShowText(page, inds[i].deat.date);	
-		}
+    while ((piece = next_piece(cp)) >= 0)
+    {
+	canvas *pv = &bp->pages[piece];
 
-		else if (inds[i].deat.plac[0] != '\0')
-		{
-		    HPDF_Page_MoveToNextLine(page);
-		    HPDF_Page_MoveTextPos(page, 0, -fontsize);
-		    HPDF_Page_ShowText(page, "d   ");
-		    HPDF_Page_ShowText(page, inds[i].deat.plac);	
-		}
+	add_page(pv);
+	draw_tile(bp->ctx, pv, bp->tp, bp->title, bp->slotwidth,
+		  bp->slotheight, bp->first + piece);
 
-		// else if (inds[i].deat.yes)
-		// {
-		// 	HPDF_Page_MoveToNextLine(page);
-		// 	HPDF_Page_MoveTextPos(page, 0, -fontsize);
-		// 	HPDF_Page_ShowTextNextLine(page, "d");
-		// }
-	    }
-	}
+	if (end_page(pv) != GPDF_SUCCESS)
+	    pv->failed = true;
     }
-
-    HPDF_Page_EndText(page);
-
-    return GPDF_SUCCESS;
 }
 
-// Draw family lines
+// Draw the tiles in batches across a crew of threads, each page in
+// memory of its own. The pages of each batch are written out in order
+// once they are all drawn, so only a batch of pages is kept at a time
 
-int draw_family_lines(HPDF_Page page, float height,
-		      float slotwidth, float slotheight)
+int draw_batches(gpdf_context *ctx, canvas *cv, tiling *tp, char *title,
+		 float slotwidth, float slotheight)
 {
-    // Draw individual famc and fams connections
+    int tiles = tp->cols * tp->rows;
+    int size = (threads * SIZE_BATCH < tiles)? threads * SIZE_BATCH: tiles;
+    int status = GPDF_SUCCESS;
+    bool crewed = false;
+    int ready = 0;
+    batch b = {};
+
+    b.ctx = ctx;
+    b.tp = tp;
+    b.title = title;
+    b.slotwidth = slotwidth;
+    b.slotheight = slotheight;
+    b.pages = calloc(size, sizeof(canvas));
+
+    if (b.pages == NULL)
+	return GPDF_ERROR;
 
-    for (int i = 0; i < SIZE_INDS; i++)
+    for (ready = 0; (ready < size) && (status == GPDF_SUCCESS); ready++)
+	status = init_canvas(&b.pages[ready], cv);
+
+    if (status == GPDF_SUCCESS)
     {
-	if (inds[i].id > 0)
-	{
-	    if (inds[i].posn.y > 0)
-	    {
-		float x = (SIZE_MARGIN + (SIZE_INSET * 2)) +
-		    (inds[i].posn.x * slotwidth);
-		float y = height - SIZE_MARGIN -
-		    (inds[i].posn.y * slotheight);
+	status = start_crew(&b.crew, threads, &b);
+	crewed = true;
+    }
 
-		if (inds[i].famc != NULL)
-		{
-		    HPDF_Page_MoveTo(page, x + slotwidth - (SIZE_INSET * 2), y);
-		    HPDF_Page_LineTo(page, x + slotwidth - SIZE_INSET, y);
-		    HPDF_Page_Stroke(page);
-		}
+    for (b.first = 0; (b.first < tiles) && (status == GPDF_SUCCESS);
+	 b.first += size)
+    {
+	int n = (b.first + size < tiles)? size: tiles - b.first;
 
-		if (inds[i].fams[0] != NULL)
-		{
-		    HPDF_Page_MoveTo(page, x, y);
-		    HPDF_Page_LineTo(page, x - SIZE_INSET, y);
-		    HPDF_Page_Stroke(page);
-		}
-	    }
-	}
+	run_crew(&b.crew, page_task, n);
+
+	for (int k = 0; (k < n) && (status == GPDF_SUCCESS); k++)
+	    if (b.pages[k].failed ||
+		(write_page(cv, &b.pages[k]) != GPDF_SUCCESS))
+		status = GPDF_ERROR;
     }
 
-    // Draw lines from wife to chilren
+    if (crewed)
+	stop_crew(&b.crew);
 
-    for (int i = 1; i < SIZE_FAMS; i++)
+    for (int k = 0; k < ready; k++)
     {
-	if ((fams[i].wife != NULL) &&
-	    (fams[i].wife->posn.y > 0))
-	{
-	    float wx = (SIZE_MARGIN + SIZE_INSET) +
-		(fams[i].wife->posn.x * slotwidth);
-	    float wy = height - SIZE_MARGIN -
-		(fams[i].wife->posn.y * slotheight);
-
-	    for (int j = 1; j < SIZE_CHLN; j++)
-	    {
-		if ((fams[i].chil[j] != NULL) &&
-		    (fams[i].chil[j]->posn.y > 0))
-		{
-		    float cx = (SIZE_MARGIN + SIZE_INSET) + slotwidth +
-			(fams[i].chil[j]->posn.x * slotwidth);
-		    float cy = height - SIZE_MARGIN -
-			(fams[i].chil[j]->posn.y * slotheight);
-
-		    HPDF_Page_MoveTo(page, wx, wy);
-		    HPDF_Page_LineTo(page, cx, cy);
-		    HPDF_Page_Stroke(page);
-		}
-	    }
-	}
+	cv->bytes += b.pages[k].bytes;
+	free_canvas(&b.pages[k]);
+    }
 
-	// Draw lines from husband to children
+    free(b.pages);
 
-	if ((fams[i].husb != NULL) &&
-	    (fams[i].husb->posn.y > 0))
-	{
-	    float hx = (SIZE_MARGIN + SIZE_INSET) +
-		(fams[i].husb->posn.x * slotwidth);
-	    float hy = height - SIZE_MARGIN -
-		(fams[i].husb->posn.y * slotheight);
+    return status;
+}
 
-	    for (int j = 1; j < SIZE_CHLN; j++)
-	    {
-		if ((fams[i].chil[j] != NULL) &&
-		     (fams[i].chil[j]->posn.y > 0))
-		{
-		    float cx = (SIZE_MARGIN + SIZE_INSET) + slotwidth +
-			(fams[i].chil[j]->posn.x * slotwidth);
-		    float cy = height - SIZE_MARGIN -
-			(fams[i].chil[j]->posn.y * slotheight);
+// Draw the chart across tiles of pages. The first libharu page has
+// already been added. Pages in memory can be drawn on several threads
 
-		    HPDF_Page_MoveTo(page, hx, hy);
-		    HPDF_Page_LineTo(page, cx, cy);
-		    HPDF_Page_Stroke(page);
-		}
-	    }
-	}
+int draw_tiles(gpdf_context *ctx, canvas *cv, tiling *tp, char *title,
+	       float slotwidth, float slotheight)
+{
+    if (cv->raw && (threads > 1))
+	return draw_batches(ctx, cv, tp, title, slotwidth, slotheight);
 
-	// Draw lines from wife to husband
+    for (int tile = 0; tile < tp->cols * tp->rows; tile++)
+    {
+	// Add the next page, with its border
 
-	if ((fams[i].wife != NULL) && (fams[i].husb != NULL) &&
-	    (fams[i].wife->posn.y > 0) &&
-	    (fams[i].husb->posn.y > 0))
-	{
-	    float wx = (SIZE_MARGIN + SIZE_INSET) +
-		(fams[i].wife->posn.x * slotwidth);
-	    float wy = height - SIZE_MARGIN -
-		(fams[i].wife->posn.y * slotheight);
+	if (((tile > 0) || cv->raw) && (add_page(cv) != GPDF_SUCCESS))
+	    return GPDF_ERROR;
 
-	    float hx = (SIZE_MARGIN + SIZE_INSET) +
-		(fams[i].husb->posn.x * slotwidth);
-	    float hy = height - SIZE_MARGIN -
-		(fams[i].husb->posn.y * slotheight);
+	draw_tile(ctx, cv, tp, title, slotwidth, slotheight, tile);
 
-	    HPDF_Page_MoveTo(page, hx, hy);
-	    HPDF_Page_LineTo(page, wx, wy);
-	    HPDF_Page_Stroke(page);
-	}
+	if (end_page(cv) != GPDF_SUCCESS)
+	    return GPDF_ERROR;
     }
 
     return GPDF_SUCCESS;
@@ -1261,7 +5356,7 @@ int draw_family_lines(HPDF_Page page, float height,
 
 // Draw the chart
 
-int draw_pdf()
+int draw_pdf(gpdf_context *ctx)
 {
     HPDF_Doc  pdf;
     HPDF_Page page;
@@ -1273,36 +5368,51 @@ int draw_pdf()
     char filename[256];
     char title[256];
 
-    strcpy(title, file);
+    strcpy(title, ctx->file);
     title[0] = toupper(title[0]);
     strcat(title, " Family Tree");
 
-    pdf = HPDF_New(error_handler, NULL);
+    // libharu pools its memory in blocks from the document heap
+
+    pdf = HPDF_NewEx(error_handler, heap_alloc, heap_free, SIZE_MPOOL,
+		     ctx);
     if (pdf == NULL)
     {
         fprintf(stderr, "%s: can't create PdfDoc object\n", progname);
         return GPDF_ERROR;
     }
 
-    if (setjmp(env))
+    if (setjmp(ctx->env))
     {
-        HPDF_Free(pdf);
+        free_document(pdf);
         return GPDF_ERROR;
     }
 
-    // Add a new page object
-    page = HPDF_AddPage(pdf);
-
-    HPDF_Page_SetWidth(page, pagesizes[pagesize][1] * multiplier);
-    HPDF_Page_SetHeight(page, pagesizes[pagesize][0] * multiplier);
+    HPDF_SetCompressionMode(pdf, compression);
 
-    height = HPDF_Page_GetHeight(page);
-    width  = HPDF_Page_GetWidth(page);
+    width  = pagesizes[pagesize][1] * multiplier;
+    height = pagesizes[pagesize][0] * multiplier;
     printf("Width %1.2f  Height %1.2f\n", height, width);
-    // Draw the border of the page
-    HPDF_Page_SetLineWidth(page, 0.6);
-    HPDF_Page_Rectangle(page, SIZE_MARGIN, SIZE_MARGIN,
-			width - (2 * SIZE_MARGIN), height - (2 * SIZE_MARGIN));
+
+    // Pages written as they are drawn don't need a libharu page, only
+    // its fonts for measuring
+
+    page = NULL;
+
+    if (!streaming || writetext)
+    {
+	// Add a new page object
+	page = HPDF_AddPage(pdf);
+
+	HPDF_Page_SetWidth(page, width);
+	HPDF_Page_SetHeight(page, height);
+
+	// Draw the border of the page
+	HPDF_Page_SetLineWidth(page, 0.6);
+	HPDF_Page_Rectangle(page, SIZE_MARGIN, SIZE_MARGIN,
+			    width - (2 * SIZE_MARGIN),
+			    height - (2 * SIZE_MARGIN));
+    }
 
     font = HPDF_GetFont(pdf, FONT, NULL);
     bold = HPDF_GetFont(pdf, BOLD, NULL);
@@ -1311,10 +5421,10 @@ int draw_pdf()
     {
 	// Horizontal slots on the page
 
-	float slotwidth = (width - (SIZE_MARGIN * 4)) / (gens + 1);
+	float slotwidth = (width - (SIZE_MARGIN * 4)) / (ctx->gens + 1);
 	float slotheight = fontsize * 6;
 
-	for (int i = 1; i < gens + 1; i++)
+	for (int i = 1; i < ctx->gens + 1; i++)
 	{
 	    float x = (2 * SIZE_MARGIN) + (i * slotwidth);
 
@@ -1339,7 +5449,7 @@ int draw_pdf()
 
 	for (int i = 0; i <= slots; i++)
 	{
-	    for (int j = 0; j < (gens + 1); j++)
+	    for (int j = 0; j < (ctx->gens + 1); j++)
 	    {
 		char s[16];
 
@@ -1352,47 +5462,170 @@ int draw_pdf()
 
 	HPDF_Page_EndText(page);
 	HPDF_SaveToFile(pdf, "slots.pdf");
+	free_document(pdf);
     }
 
     else
     {
-	int result;
-	HPDF_REAL tw;
+	// Read the positions unless they have been laid out
+
+	if (!autolayout && !ctx->positioned &&
+	    (read_textfile(ctx) != GPDF_SUCCESS))
+	{
+	    free_document(pdf);
+	    return GPDF_ERROR;
+	}
+
+	// A tiled chart is the size of the pages less the overlaps
+
+	tiling tile = {};
+
+	tile.cols = tilecols;
+	tile.rows = tilerows;
+	tile.width = width;
+	tile.height = height;
+	tile.spanx = width - (SIZE_MARGIN * 2);
+	tile.spany = height - (SIZE_MARGIN * 2);
+	tile.stepx = tile.spanx - SIZE_OVERLAP;
+	tile.stepy = tile.spany - SIZE_OVERLAP;
+	tile.chartwidth = width + ((tilecols - 1) * tile.stepx);
+	tile.chartheight = height + ((tilerows - 1) * tile.stepy);
+
+	float slotheight = (tile.chartheight - (SIZE_MARGIN * 2)) /
+	    (ctx->slotmax + 1);
+
+	float slotwidth = (tile.chartwidth - (SIZE_MARGIN * 2) -
+			   (SIZE_INSET * 2)) / (ctx->gens + 1);
+
+	HPDF_Font fonts[] = {font, bold};
+	canvas cv = {};
+	struct timeval start, end;
+	int status;
+
+	cv.pdf = pdf;
+	cv.page = page;
+	cv.fonts[RUN_NORMAL] = font;
+	cv.fonts[RUN_BOLD] = bold;
+	cv.width = width;
+	cv.height = height;
+	cv.slotwidth = slotwidth;
+	cv.compress = (compression != HPDF_COMP_NONE);
+
+	strcpy(filename, ctx->file);
+	strcat(filename, ".pdf");
 
-	result = read_textfile();
+	gettimeofday(&start, NULL);
 
-	if (result != GPDF_SUCCESS)
+	if ((render_individuals(ctx) != GPDF_SUCCESS) ||
+	    (measure_individuals(ctx, fonts) != GPDF_SUCCESS) ||
+	    (find_family_lines(ctx, tile.chartheight, slotwidth,
+			       slotheight) != GPDF_SUCCESS))
+	{
+	    fprintf(stderr, "%s: Can't render individuals\n", progname);
+	    free_document(pdf);
 	    return GPDF_ERROR;
+	}
 
-	HPDF_Page_Rectangle(page, width - 200 - SIZE_MARGIN,
-			    SIZE_MARGIN, 200, 22);
-	HPDF_Page_Stroke(page);
+	if (((tilecols * tilerows) > 1) &&
+	    (index_tiles(ctx, &tile, slotwidth, slotheight) != GPDF_SUCCESS))
+	{
+	    fprintf(stderr, "%s: Can't index tiles\n", progname);
+	    free_csr(&tile.inds);
+	    free_csr(&tile.lines);
+	    free_document(pdf);
+	    return GPDF_ERROR;
+	}
 
-	// Draw the title of the page (with positioning center).
-	HPDF_Page_SetFontAndSize(page, font, 18);
+	// Pages written as they are drawn go straight to the file
 
-	tw = HPDF_Page_TextWidth(page, title);
-	HPDF_Page_BeginText(page);
-	HPDF_Page_TextOut(page, (width - 100 - SIZE_MARGIN) - tw / 2,
-			  SIZE_MARGIN + 5, title);
-	HPDF_Page_EndText(page);
+	if (streaming && (open_canvas(&cv, filename) != GPDF_SUCCESS))
+	{
+	    free_csr(&tile.inds);
+	    free_csr(&tile.lines);
+	    free_document(pdf);
+	    return GPDF_ERROR;
+	}
 
-	float slotheight = (height - (SIZE_MARGIN * 2)) / (slotmax + 1);
+	if ((tilecols * tilerows) > 1)
+	{
+	    status = draw_tiles(ctx, &cv, &tile, title, slotwidth,
+				slotheight);
 
-	float slotwidth = (width - (SIZE_MARGIN * 2) -
-			   (SIZE_INSET * 2)) / (gens + 1);
+	    if (showstats)
+		printf("Tiles %d x %d, %d individuals and %d lines placed\n",
+		       tilecols, tilerows, tile.inds.index[tilecols * tilerows],
+		       tile.lines.index[tilecols * tilerows]);
 
-	draw_individuals(page, font, bold, fontsize, height,
-			 slotwidth, slotheight);
-	draw_family_lines(page, height, slotwidth, slotheight);
+	    free_csr(&tile.inds);
+	    free_csr(&tile.lines);
+	}
 
-	strcpy(filename, file);
-	strcat(filename, ".pdf");
+	else
+	{
+	    status = (streaming)? add_page(&cv): GPDF_SUCCESS;
+
+	    if (status == GPDF_SUCCESS)
+	    {
+		draw_title(&cv, title, width);
+		draw_individuals(ctx, &cv, fontsize, height, slotwidth,
+				 slotheight, NULL, ctx->indindex - 1);
+		draw_ticks(ctx, &cv, height, slotwidth, slotheight, NULL,
+			   ctx->indindex - 1);
+		draw_lines(ctx, &cv, NULL, ctx->nsegments);
+		status = end_page(&cv);
+	    }
+	}
+
+	gettimeofday(&end, NULL);
+
+	if (showstats)
+	{
+	    float widest = 0;
+
+	    for (int i = 1; i < ctx->indindex; i++)
+		if (widest < ctx->widths[i])
+		    widest = ctx->widths[i];
+
+	    printf("Measure %d runs, %d strings, widest %1.1f pt\n",
+		   ctx->nruns, ctx->nmeasures, widest * fontsize);
+	    printf("Draw %d runs in %1.3f sec, %u bytes of content\n",
+		   ctx->nruns, elapsed(&start, &end), cv.bytes);
+	}
 
-	// Save file
+	// Write the end of the streamed file, or save the document
 
-	HPDF_SaveToFile(pdf, filename);
-	HPDF_Free(pdf);
+	gettimeofday(&start, NULL);
+
+	if (streaming)
+	{
+	    if (close_canvas(&cv, title) != GPDF_SUCCESS)
+		status = GPDF_ERROR;
+	}
+
+	else
+	    HPDF_SaveToFile(pdf, filename);
+
+	gettimeofday(&end, NULL);
+	free_document(pdf);
+
+	if (showstats)
+	{
+	    struct stat st;
+
+	    if (stat(filename, &st) == 0)
+		printf("Write %lld bytes in %1.3f sec\n", (long long)st.st_size,
+		       elapsed(&start, &end));
+
+	    printf("Heap %u allocations, %u frees, %d blocks, %zu bytes\n",
+		   docheap.allocs, docheap.frees, docheap.blocks,
+		   docheap.bytes);
+	}
+
+	if (status != GPDF_SUCCESS)
+	{
+	    fprintf(stderr, "%s: Can't write %s\n", progname, filename);
+	    return GPDF_ERROR;
+	}
     }
 
     return GPDF_SUCCESS;
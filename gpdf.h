@@ -30,22 +30,39 @@
 #define FONT "Helvetica"
 #define BOLD "Helvetica-Bold"
 
+// Start of a binary positions file
+
+#define POSN_MAGIC "GPDFPOS1"
+
+// Start and version of a snapshot of the parsed tree
+
+#define SNAP_MAGIC "GPDFSNAP"
+#define SNAP_VERSION 2
+
 typedef enum
-    {SIZE_INDS = 256,
+    {SIZE_HEAP = 1048576,
+     SIZE_MPOOL = 65536,
+     SIZE_EDGES = 1024,
+     SIZE_SEGMENTS = 1024,
+     SIZE_TILES = 1024,
+     SIZE_OBJECTS = 1024,
+     SIZE_BLOCK = 1024,
+     SIZE_RUNS = 1024,
+     SIZE_POOL = 4096,
+     SIZE_HASH = 512,
+     SIZE_INDS = 256,
      SIZE_LINE = 256,
      SIZE_FAMS = 128,
      SIZE_NAME = 64,
-     SIZE_GIVN = 32,
-     SIZE_SURN = 32,
-     SIZE_PLAC = 32,
-     SIZE_OCCU = 32,
+     SIZE_ALIGN = 64,
      SIZE_XREF = 32,
-     SIZE_NICK = 16,
+     SIZE_THREADS = 64,
+     SIZE_CHUNKS = 24,
      SIZE_DATE = 16,
-     SIZE_CHLN = 16,
+     SIZE_UNKNOWN = 8,
      SIZE_GENS = 16,
-     SIZE_FMSS = 4,
-     SIZE_SEX  = 4}
+     SIZE_SWEEPS = 4,
+     SIZE_BATCH = 4}
     gpdf_size_t;
 
 typedef enum
@@ -60,7 +77,9 @@ typedef enum
     {SIZE_PAGE    = SIZE_A3,
      SIZE_FONT    = 8,
      SIZE_MARGIN  = 20,
-     SIZE_INSET   = 10}
+     SIZE_OVERLAP = 36,
+     SIZE_INSET   = 10,
+     SIZE_MARK    = 10}
     gpdf_page_t;
 
 typedef enum
@@ -74,6 +93,33 @@ typedef enum
      TYPE_ATTR}
     gpdf_type_t;
 
+typedef enum
+    {TAG_NONE,
+     TAG_HEAD,
+     TAG_FILE,
+     TAG_INDI,
+     TAG_FAM,
+     TAG_NAME,
+     TAG_SEX,
+     TAG_BIRT,
+     TAG_DEAT,
+     TAG_FAMC,
+     TAG_FAMS,
+     TAG_NCHI,
+     TAG_OCCU,
+     TAG_HUSB,
+     TAG_WIFE,
+     TAG_CHIL,
+     TAG_MARR,
+     TAG_DIV,
+     TAG_GIVN,
+     TAG_SURN,
+     TAG_NICK,
+     TAG_MARNM,
+     TAG_DATE,
+     TAG_PLAC}
+    gpdf_tag_t;
+
 typedef enum
     {STATE_HEAD,
      STATE_INDI,
@@ -81,6 +127,61 @@ typedef enum
      STATE_NONE = -1}
     gpdf_state_t;
 
+typedef enum
+    {LINK_FAMS,
+     LINK_CHIL,
+     LINK_NONE = -1}
+    gpdf_link_t;
+
+typedef enum
+    {RUN_NORMAL,
+     RUN_BOLD}
+    gpdf_run_t;
+
+typedef enum
+    {SNAP_INDS,
+     SNAP_FAMS,
+     SNAP_INDTEXT,
+     SNAP_FAMTEXT,
+     SNAP_STRINGS,
+     SNAP_INDHASH,
+     SNAP_FAMHASH,
+     SNAP_STRHASH,
+     SNAP_PARENTS,
+     SNAP_SPOUSES,
+     SNAP_FAMILIES,
+     SNAP_CHILDREN,
+     SNAP_SECTIONS}
+    gpdf_snap_t;
+
+typedef enum
+    {PLACE_NONE,
+     PLACE_READ,
+     PLACE_MOVED}
+    gpdf_place_t;
+
+typedef enum
+    {MARK_FIXED = 1,
+     MARK_AFFECTED,
+     MARK_PLACED}
+    gpdf_mark_t;
+
+typedef enum
+    {TICK_FAMC = 1,
+     TICK_FAMS,
+     TICK_BOTH}
+    gpdf_tick_t;
+
+typedef enum
+    {OBJ_CATALOG = 1,
+     OBJ_PAGES,
+     OBJ_FONT,
+     OBJ_BOLD,
+     OBJ_INFO,
+     OBJ_TICKS,
+     OBJ_FIRST = OBJ_TICKS + TICK_BOTH}
+    gpdf_object_t;
+
 typedef enum
     {DATE_BIRT,
      DATE_DEAT,
@@ -97,11 +198,13 @@ typedef enum
      PLAC_NONE = -1}
     gpdf_plac_t;
 
+// Strings are offsets into the string pool
+
 typedef struct
 {
     bool yes;
-    char date[SIZE_DATE];
-    char plac[SIZE_PLAC];
+    int date;
+    int plac;
 } birt, deat, marr, divc;
 
 typedef struct
@@ -109,47 +212,396 @@ typedef struct
     float x, y;
 } coord;
 
+typedef struct
+{
+    char *p;
+    int n;
+} view;
+
+typedef struct
+{
+    char *chunks[SIZE_CHUNKS];
+    size_t size;
+    int base;
+} arena;
+
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t used;
+} pool;
+
+typedef struct
+{
+    unsigned int hash;
+    int id;
+} slot;
+
+typedef struct
+{
+    slot *slots;
+    int size;
+    int count;
+} xindex;
+
+// Records hold the fields the passes over the tree use, the text is
+// kept apart in another arena with the same ids
+
 typedef struct indi_s
 {
     int id;
+    bool defn;
+    char sex;
+    char place;
     int gens;
     int nchi;
     coord posn;
-    char xref[SIZE_XREF];
-    char name[SIZE_NAME];
-    char givn[SIZE_GIVN];
-    char surn[SIZE_GIVN];
-    char marn[SIZE_NAME];
-    char nick[SIZE_NICK];
-    char occu[SIZE_OCCU];
-    char sex[SIZE_SEX];
-    birt birt;
-    deat deat;
     struct fam_s *famc;
-    struct fam_s *fams[SIZE_FMSS];
 } indi;
 
 typedef struct fam_s
 {
     int id;
+    bool defn;
     indi *husb;
     indi *wife;
-    char xref[SIZE_XREF];
+} faml;
+
+typedef struct
+{
+    unsigned int hash;
+    int xref;
+    int name;
+    int givn;
+    int surn;
+    int marn;
+    int nick;
+    int occu;
+    birt birt;
+    deat deat;
+} itext;
+
+typedef struct
+{
+    unsigned int hash;
+    int xref;
     marr marr;
     divc divc;
-    indi *chil[SIZE_CHLN];
-} faml;
+} ftext;
+
+// Links read from FAMS and CHIL lines
+
+typedef struct
+{
+    int type;
+    int from;
+    int to;
+} edge;
+
+// Text to show in one font on one line of an individual
+
+typedef struct
+{
+    int font;
+    int line;
+    int text;
+} run;
+
+// A family line on the chart
+
+typedef struct
+{
+    float x0, y0;
+    float x1, y1;
+} lineseg;
+
+// Width of a string in a font at 1 point
+
+typedef struct
+{
+    int text;
+    int font;
+    float width;
+} measure;
+
+// Binary positions file header, and the fixed part of each record,
+// which follows the length and the xref
+
+typedef struct
+{
+    char magic[8];
+    int count;
+} posnhead;
+
+typedef struct
+{
+    float x;
+    float y;
+    int gens;
+} posnrec;
+
+// Snapshot header, the fields up to hash say which input it is of and
+// must all match, except that a different time will do if the contents
+// hash the same. The sections follow at the offsets, the last one is a
+// spare for sections that don't need one
+
+typedef struct
+{
+    char magic[8];
+    int version;
+    int sizes[4];
+    long long filesize;
+    long long mtime;
+    unsigned long long hash;
+    int indindex;
+    int famindex;
+    int hashsize;
+    int hashcount;
+    int famsize;
+    int famcount;
+    int strsize;
+    int strcount;
+    size_t strings;
+    long long total;
+    char file[SIZE_NAME];
+    long long offsets[SNAP_SECTIONS + 1];
+} snaphead;
+
+// Place of an individual in a column while ordering
+
+typedef struct
+{
+    float key;
+    float last;
+    int id;
+} rank;
+
+// Compressed rows, the ids for row i are list[index[i]] up to
+// list[index[i + 1]]
+
+typedef struct
+{
+    int *index;
+    int *list;
+} csr;
+
+// Threads that wait for a task and take pieces of it in turn
+
+typedef struct crew_s
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    pthread_t tids[SIZE_THREADS];
+    int workers;
+    int round;
+    int busy;
+    bool quit;
+    void (*task)(struct crew_s *);
+    int next;
+    int pieces;
+    void *arg;
+} crew;
+
+typedef struct
+{
+    arena inds;
+    arena fams;
+    arena indtext;
+    arena famtext;
+    pool strings;
+    xindex strhash;
+    xindex indhash;
+    xindex famhash;
+    int indindex;
+    int famindex;
+    int lookups;
+    int probes;
+    int merges;
+    int mergeprobes;
+    int interns;
+    int shared;
+    size_t saved;
+    indi *indp;
+    faml *famp;
+    itext *indt;
+    ftext *famt;
+    int state;
+    int date;
+    int plac;
+    edge *edges;
+    int nedges;
+    int maxedges;
+    csr parents;
+    csr spouses;
+    csr families;
+    csr children;
+    run *runs;
+    int *runindex;
+    int nruns;
+    int maxruns;
+    pool scratch;
+    xindex widthhash;
+    measure *measures;
+    int nmeasures;
+    int maxmeasures;
+    float *widths;
+    lineseg *segments;
+    int nsegments;
+    int maxsegments;
+    int gens;
+    int genc[SIZE_GENS];
+    int slotmax;
+    long long crossings[2];
+    int kept;
+    int moved;
+    int removed;
+    int added;
+    int placed;
+    bool positioned;
+    char unknown[SIZE_UNKNOWN][SIZE_XREF];
+    size_t bytes;
+    char *snapshot;
+    size_t snapsize;
+    char file[SIZE_NAME];
+    jmp_buf env;
+} gpdf_context;
+
+typedef struct
+{
+    gpdf_context ctx;
+    gpdf_context *global;
+    char *start;
+    char *end;
+    int *indmap;
+    int *fammap;
+    bool *indmerge;
+    bool *fammerge;
+    int offset;
+    int status;
+} chunk;
+
+// Pages of a chart spread over tiles, each a window on the chart that
+// overlaps its neighbours, with the individuals and lines on each
+
+typedef struct
+{
+    int cols;
+    int rows;
+    float width;
+    float height;
+    float spanx;
+    float spany;
+    float stepx;
+    float stepy;
+    float chartwidth;
+    float chartheight;
+    csr inds;
+    csr lines;
+} tiling;
+
+// Where the chart is drawn, a libharu page, or raw page content in
+// memory, deflated if it's compressed. Pages are streamed to the file
+// as they are finished, with the offsets of the objects kept for the
+// xref table. The ticks on each individual are paths on a libharu
+// page, or forms in the file
+
+typedef struct
+{
+    HPDF_Doc pdf;
+    HPDF_Page page;
+    HPDF_Font fonts[2];
+    FILE *file;
+    uint64_t offset;
+    uint64_t *offsets;
+    int nobjects;
+    int maxobjects;
+    int *kids;
+    int nkids;
+    int maxkids;
+    char *content;
+    size_t size;
+    size_t maxsize;
+    float width;
+    float height;
+    float slotwidth;
+    float textx;
+    float texty;
+    unsigned int bytes;
+    bool raw;
+    bool compress;
+    bool deflate;
+    bool failed;
+    z_stream zstream;
+} canvas;
+
+// A batch of pages drawn on a crew of threads, each on a canvas of
+// its own
+
+typedef struct
+{
+    gpdf_context *ctx;
+    crew crew;
+    canvas *pages;
+    tiling *tp;
+    char *title;
+    float slotwidth;
+    float slotheight;
+    int first;
+} batch;
+
+// Memory for the document, blocks that allocations are bumped off,
+// each block starting with a link to the one before
+
+typedef struct
+{
+    char *block;
+    size_t size;
+    size_t used;
+    size_t bytes;
+    unsigned int allocs;
+    unsigned int frees;
+    int blocks;
+} heap;
+
+// The column being ordered, shared with the crew
+
+typedef struct
+{
+    gpdf_context *ctx;
+    crew crew;
+    csr column;
+    float *place;
+    rank *ranks;
+    rank *spare;
+    int first;
+    int n;
+    int segments;
+    bool down;
+} sweep;
 
 // Functions
 
-int parse_gedcom_file(char *);
-int find_generations();
-int read_textfile();
-int write_textfile();
-int draw_pdf();
-int object(char *, char *);
-int property(char *, char *);
-int attrib(char *, char *);
+int parse_gedcom_file(gpdf_context *, char *);
+int load_snapshot(gpdf_context *, char *);
+int save_snapshot(gpdf_context *, char *);
+void unload_snapshot(gpdf_context *);
+int find_generations(gpdf_context *);
+int layout_individuals(gpdf_context *);
+int relayout_individuals(gpdf_context *);
+int read_textfile(gpdf_context *);
+int write_textfile(gpdf_context *);
+int write_posnfile(gpdf_context *);
+int draw_pdf(gpdf_context *);
+int object(gpdf_context *, view, view);
+int property(gpdf_context *, view, view);
+int attrib(gpdf_context *, view, view);
+void init_context(gpdf_context *);
+void free_context(gpdf_context *);
+int build_graph(gpdf_context *);
+int render_individuals(gpdf_context *);
+float elapsed(struct timeval *, struct timeval *);
 
 #ifdef __MINGW32__
 int getline(char **, size_t *, FILE *);